@@ -0,0 +1,489 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_BINARY_HPP
+#define LEX_BINARY_HPP
+
+#include "lex.hpp"
+#include "input.hpp"
+#include "writer.hpp"
+
+#include <limits>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace lak
+{
+    // a whole file mapped read only, or read into memory where mmap isn't available and for
+    // pipes and devices, which can't be mapped
+    struct mapped_file_t
+    {
+        const char *data = nullptr;
+        size_t size = 0;
+        string storage;
+
+        mapped_file_t() {}
+        mapped_file_t(const mapped_file_t &) = delete;
+        mapped_file_t &operator=(const mapped_file_t &) = delete;
+        ~mapped_file_t() { close(); }
+
+        bool open(const string &path)
+        {
+            close();
+#ifdef _WIN32
+            std::ifstream strm(path, std::ios::binary | std::ios::ate);
+            if (!strm.is_open()) return false;
+            storage.resize((size_t)strm.tellg());
+            strm.seekg(0);
+            if (!strm.read(&storage[0], storage.size()) && !storage.empty()) return false;
+            data = storage.data();
+            size = storage.size();
+            return true;
+#else
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            bool rtn = fstat(fd, &st) == 0;
+            if (rtn && !S_ISREG(st.st_mode))
+            {
+                rtn = lex::read_fd(fd, storage);
+                data = storage.data();
+                size = storage.size();
+            }
+            else if (rtn && st.st_size > 0)
+            {
+                void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                rtn = map != MAP_FAILED;
+                if (rtn)
+                {
+                    data = (const char *)map;
+                    size = (size_t)st.st_size;
+                    madvise(map, size, MADV_SEQUENTIAL);
+                }
+            }
+            ::close(fd);
+            return rtn;
+#endif
+        }
+
+        void close()
+        {
+#ifndef _WIN32
+            if (data != nullptr && data != storage.data()) munmap((void *)data, size);
+#endif
+            storage.clear();
+            data = nullptr;
+            size = 0;
+        }
+
+        std::string_view view() const { return {data, size}; }
+    };
+
+    // little endian whatever the host is, these compile to a plain load or store on one
+    template<typename T>
+    inline void store_le(char *out, T value)
+    {
+        for (size_t i = 0; i < sizeof(T); ++i)
+            out[i] = (char)(value >> (i * 8));
+    }
+
+    template<typename T>
+    inline T load_le(const char *in)
+    {
+        T rtn = 0;
+        for (size_t i = 0; i < sizeof(T); ++i)
+            rtn |= (T)(uint8_t)in[i] << (i * 8);
+        return rtn;
+    }
+
+    // LEB128
+    inline void write_varint(string &out, uint64_t value)
+    {
+        for (; value >= 0x80; value >>= 7)
+            out += (char)(value | 0x80);
+        out += (char)value;
+    }
+
+    // returns false if the varint runs past end
+    inline bool read_varint(const char *&it, const char *end, uint64_t &value)
+    {
+        value = 0;
+        for (int shift = 0; it != end && shift < 64; shift += 7)
+        {
+            const uint8_t c = (uint8_t)*it++;
+            value |= (uint64_t)(c & 0x7F) << shift;
+            if (c < 0x80) return true;
+        }
+        return false;
+    }
+}
+
+namespace lex
+{
+    // binary token streams, a sequence of one section per lexed file:
+    //   binary_header_t           binary_header_size bytes, the fields in order
+    //   name                      name_size bytes, the source path
+    //   rule names                rule_count of varint length + bytes
+    //   string offsets            uint32 string_count + 1, into the string blob
+    //   string blob               every distinct token value once
+    //   token records             token_count of
+    //                               kind   u8, type | has rule << 3 | has id << 4 | short gap << 5
+    //                               gap    varint, only when the short gap is 7, the gap less 7
+    //                                      the gap is the bytes between the previous token's end and this one's start
+    //                               string varint, index of the value in the string table
+    //                               rule   varint if it has one
+    //                               id     varint if it has one
+    // the checksum is lak::hash64 of everything after the header. integers are little endian on
+    // every host, the header and string offsets go through lak::store_le and lak::load_le
+    static const char binary_magic[4] = {'L', 'E', 'X', 'T'};
+    static const uint32_t binary_version = 2;
+    // seeds source_hash, apart from any seed the token cache keys entries with
+    static const uint64_t binary_source_seed = 0x9E3779B97F4A7C15ULL;
+
+    struct binary_header_t
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t source_size;
+        uint64_t token_count;
+        uint64_t checksum;
+        uint32_t name_size;
+        uint32_t rule_count;
+        uint32_t rules_size;
+        uint32_t string_count;
+        uint64_t strings_size;
+        uint64_t tokens_size;
+        uint64_t source_hash; // lak::hash64 of the source seeded with binary_source_seed
+
+        void encode(char *out) const
+        {
+            std::memcpy(out, magic, sizeof(magic));
+            lak::store_le(out + 4, version);
+            lak::store_le(out + 8, source_size);
+            lak::store_le(out + 16, token_count);
+            lak::store_le(out + 24, checksum);
+            lak::store_le(out + 32, name_size);
+            lak::store_le(out + 36, rule_count);
+            lak::store_le(out + 40, rules_size);
+            lak::store_le(out + 44, string_count);
+            lak::store_le(out + 48, strings_size);
+            lak::store_le(out + 56, tokens_size);
+            lak::store_le(out + 64, source_hash);
+        }
+
+        void decode(const char *in)
+        {
+            std::memcpy(magic, in, sizeof(magic));
+            version = lak::load_le<uint32_t>(in + 4);
+            source_size = lak::load_le<uint64_t>(in + 8);
+            token_count = lak::load_le<uint64_t>(in + 16);
+            checksum = lak::load_le<uint64_t>(in + 24);
+            name_size = lak::load_le<uint32_t>(in + 32);
+            rule_count = lak::load_le<uint32_t>(in + 36);
+            rules_size = lak::load_le<uint32_t>(in + 40);
+            string_count = lak::load_le<uint32_t>(in + 44);
+            strings_size = lak::load_le<uint64_t>(in + 48);
+            tokens_size = lak::load_le<uint64_t>(in + 56);
+            source_hash = lak::load_le<uint64_t>(in + 64);
+        }
+    };
+    static const size_t binary_header_size = 72;
+
+    // most gaps are a single space or newline so short ones are packed into the kind byte
+    enum : uint8_t { KIND_TYPE = 0x07, KIND_RULE = 0x08, KIND_ID = 0x10, KIND_GAP_SHIFT = 5, KIND_LONG_GAP = 7 };
+
+    // builds the section for one file from the tokens as they're lexed. values are interned by
+    // view, so source has to stay alive until finish
+    struct binary_encoder_t
+    {
+        string name;
+        std::string_view source;
+        const vector<rule_t> *rules = nullptr;
+        unordered_map<std::string_view, uint32_t> string_ids;
+        vector<std::string_view> strings;
+        string records;
+        uint64_t count = 0;
+        size_t end = 0; // offset just past the previous token
+
+        void reset(const string &file, std::string_view src, const vocabulary_t &vocab)
+        {
+            name = file;
+            source = src;
+            rules = &vocab.rules;
+            string_ids.clear();
+            strings.clear();
+            records.clear();
+            count = 0;
+            end = 0;
+        }
+
+        inline void add(const token_view_t &token)
+        {
+            const size_t offset = token.value.data() - source.data();
+            auto [it, added] = string_ids.emplace(token.value, (uint32_t)strings.size());
+            if (added) strings.push_back(token.value);
+
+            const size_t gap = offset - end;
+            const uint8_t short_gap = (uint8_t)std::min<size_t>(gap, KIND_LONG_GAP);
+            records += (char)((uint8_t)token.type | (token.rule >= 0 ? KIND_RULE : 0) | (token.id >= 0 ? KIND_ID : 0) |
+                (short_gap << KIND_GAP_SHIFT));
+            if (short_gap == KIND_LONG_GAP) lak::write_varint(records, gap - KIND_LONG_GAP);
+            lak::write_varint(records, it->second);
+            if (token.rule >= 0) lak::write_varint(records, (uint64_t)token.rule);
+            if (token.id >= 0) lak::write_varint(records, (uint64_t)token.id);
+            end = offset + token.value.size();
+            ++count;
+        }
+
+        // string offsets are 32 bit, a section whose strings don't fit is an error and nothing is written
+        bool finish(writer_t &out, string &error)
+        {
+            uint64_t blob_size = 0;
+            for (std::string_view str : strings)
+                blob_size += str.size();
+            if (blob_size > UINT32_MAX)
+            {
+                error = name + ": over 4GiB of distinct token text, too much for one binary section";
+                return false;
+            }
+
+            string body = name;
+            string rule_names;
+            for (const rule_t &rule : *rules)
+            {
+                lak::write_varint(rule_names, rule.name.size());
+                rule_names += rule.name;
+            }
+            body += rule_names;
+            const size_t offsets_at = body.size();
+            body.resize(offsets_at + (strings.size() + 1) * sizeof(uint32_t));
+            uint32_t offset = 0;
+            for (size_t i = 0; i <= strings.size(); ++i)
+            {
+                lak::store_le(&body[offsets_at + i * sizeof(uint32_t)], offset);
+                if (i < strings.size()) offset += (uint32_t)strings[i].size();
+            }
+            for (std::string_view str : strings)
+                body.append(str.data(), str.size());
+            const uint64_t strings_size = body.size() - offsets_at;
+
+            binary_header_t header = {};
+            std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+            header.version = binary_version;
+            header.source_size = source.size();
+            header.token_count = count;
+            header.name_size = (uint32_t)name.size();
+            header.rule_count = (uint32_t)rules->size();
+            header.rules_size = (uint32_t)rule_names.size();
+            header.string_count = (uint32_t)strings.size();
+            header.strings_size = strings_size;
+            header.tokens_size = records.size();
+            header.source_hash = lak::hash64(source.data(), source.size(), binary_source_seed);
+            uint64_t checksum = lak::hash64(body.data(), body.size());
+            header.checksum = lak::hash64(records.data(), records.size(), checksum);
+
+            char encoded[binary_header_size];
+            header.encode(encoded);
+            out.write(encoded, sizeof(encoded));
+            out.write(body);
+            out.write(records);
+            return true;
+        }
+    };
+
+    // a token read back from a binary stream, value points into the stream
+    struct binary_token_t { token_type type; int rule; int id; uint64_t offset; std::string_view value; };
+
+    // one section of a binary stream, views into the mapped stream and never copies
+    struct binary_file_t
+    {
+        binary_header_t header;
+        std::string_view name;
+        vector<std::string_view> rules;
+        const char *offsets = nullptr;
+        const char *blob = nullptr;
+        std::string_view body;    // everything the checksum covers
+        std::string_view records;
+
+        inline std::string_view string(uint64_t index) const
+        {
+            const uint32_t begin = lak::load_le<uint32_t>(offsets + index * sizeof(uint32_t));
+            const uint32_t end = lak::load_le<uint32_t>(offsets + (index + 1) * sizeof(uint32_t));
+            return {blob + begin, (size_t)(end - begin)};
+        }
+
+        // the checksum, and that every token record reads back, so a record with a kind that
+        // isn't a token type is rejected here rather than trusted by whoever prints it
+        bool verify() const
+        {
+            uint64_t checksum = lak::hash64(body.data(), body.size() - records.size());
+            if (lak::hash64(records.data(), records.size(), checksum) != header.checksum)
+                return false;
+            uint64_t read = 0;
+            binary_token_t token;
+            for (auto cursor = tokens(); cursor.next(token); ++read);
+            return read == header.token_count;
+        }
+
+        // writes this section back out under another name, with the checksum to match
+        void write(writer_t &out, std::string_view new_name) const
+        {
+            binary_header_t renamed = header;
+            renamed.name_size = (uint32_t)new_name.size();
+            std::string body_start(new_name);
+            body_start.append(body.data() + name.size(), body.size() - name.size() - records.size());
+            renamed.checksum = lak::hash64(records.data(), records.size(), lak::hash64(body_start.data(), body_start.size()));
+            char encoded[binary_header_size];
+            renamed.encode(encoded);
+            out.write(encoded, sizeof(encoded));
+            out.write(body_start);
+            out.write(records);
+        }
+
+        // walks the token records, a cursor is a pointer into them
+        struct cursor_t
+        {
+            const binary_file_t *file;
+            const char *it;
+            uint64_t end = 0;
+
+            // false at the end of the file or on a malformed record
+            inline bool next(binary_token_t &token)
+            {
+                const char *const last = file->records.data() + file->records.size();
+                if (it == last) return false;
+                const uint8_t kind = (uint8_t)*it++;
+                uint64_t gap = kind >> KIND_GAP_SHIFT, string, rule = (uint64_t)-1, id = (uint64_t)-1;
+                bool ok = gap < KIND_LONG_GAP || lak::read_varint(it, last, gap);
+                if (kind >> KIND_GAP_SHIFT == KIND_LONG_GAP) gap += KIND_LONG_GAP;
+                ok = ok && (kind & KIND_TYPE) <= (uint8_t)token_type::COMMENT &&
+                    lak::read_varint(it, last, string) && string < file->header.string_count &&
+                    (!(kind & KIND_RULE) || (lak::read_varint(it, last, rule) && rule < file->header.rule_count)) &&
+                    (!(kind & KIND_ID) || (lak::read_varint(it, last, id) && id <= (uint64_t)std::numeric_limits<int>::max()));
+                if (!ok)
+                {
+                    it = last;
+                    return false;
+                }
+                token.type = (token_type)(kind & KIND_TYPE);
+                token.rule = (int)rule;
+                token.id = (int)id;
+                token.offset = end + gap;
+                token.value = file->string(string);
+                end = token.offset + token.value.size();
+                return true;
+            }
+        };
+
+        cursor_t tokens() const { return {this, records.data()}; }
+    };
+
+    // iterates the sections of a binary stream held in memory, usually an mmapped file
+    struct binary_reader_t
+    {
+        std::string_view data;
+        size_t pos = 0;
+
+        binary_reader_t(std::string_view stream) : data(stream) {}
+
+        // false at the end of the stream or if the next section is malformed, in which case
+        // error says why
+        bool next(binary_file_t &file, string &error)
+        {
+            error.clear();
+            if (pos == data.size()) return false;
+            if (data.size() - pos < binary_header_size)
+            {
+                error = "truncated header at byte " + std::to_string(pos);
+                return false;
+            }
+            binary_header_t &header = file.header;
+            header.decode(data.data() + pos);
+            if (std::memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0 || header.version != binary_version)
+            {
+                error = "bad magic or version at byte " + std::to_string(pos);
+                return false;
+            }
+            // each size on its own against what's left, a sum of them could wrap
+            const uint64_t offsets_size = ((uint64_t)header.string_count + 1) * sizeof(uint32_t);
+            uint64_t remaining = data.size() - pos - binary_header_size;
+            bool fits = true;
+            for (uint64_t size : {(uint64_t)header.name_size, (uint64_t)header.rules_size, header.strings_size, header.tokens_size})
+            {
+                fits = fits && size <= remaining;
+                if (fits) remaining -= size;
+            }
+            if (header.strings_size < offsets_size || !fits)
+            {
+                error = "truncated section at byte " + std::to_string(pos);
+                return false;
+            }
+
+            const uint64_t body_size = (uint64_t)header.name_size + header.rules_size + header.strings_size + header.tokens_size;
+            const char *it = data.data() + pos + binary_header_size;
+            file.body = {it, (size_t)body_size};
+            file.name = {it, header.name_size};
+            it += header.name_size;
+            const char *rules_end = it + header.rules_size;
+            file.rules.clear();
+            for (uint64_t i = 0, size; i < header.rule_count; ++i, it += size)
+            {
+                if (!lak::read_varint(it, rules_end, size) || size > (uint64_t)(rules_end - it))
+                {
+                    error = "bad rule table at byte " + std::to_string(pos);
+                    return false;
+                }
+                file.rules.emplace_back(it, (size_t)size);
+            }
+            it = rules_end;
+            file.offsets = it;
+            file.blob = it + offsets_size;
+            // checked once here so the cursor can trust them
+            bool ok = true;
+            uint32_t last = 0;
+            for (uint64_t i = 0; i <= header.string_count && ok; ++i)
+            {
+                const uint32_t offset = lak::load_le<uint32_t>(it + i * sizeof(uint32_t));
+                ok = offset >= last && (i > 0 || offset == 0);
+                last = offset;
+            }
+            if (!ok || last != header.strings_size - offsets_size)
+            {
+                error = "bad string table at byte " + std::to_string(pos);
+                return false;
+            }
+            it += header.strings_size;
+            file.records = {it, (size_t)header.tokens_size};
+            pos += binary_header_size + body_size;
+            return true;
+        }
+    };
+}
+
+#endif
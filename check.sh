@@ -0,0 +1,460 @@
+#!/bin/sh
+# regression checks for the lex CLI, each one lexes a small input and compares the output
+#   LEX=./lex ./check.sh
+set -e
+
+LEX=${LEX:-./lex}
+CXX=${CXX:-c++}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+export LEX_CACHE_DIR="$dir/cache"
+
+failed=0
+
+# expect <name> <expected output file> <command...>, the command's stdout has to match
+expect() {
+    name=$1
+    expected=$2
+    shift 2
+    if "$@" > "$dir/actual" 2> "$dir/error" && cmp -s "$expected" "$dir/actual"; then
+        echo "ok      $name"
+    else
+        echo "FAILED  $name"
+        diff "$expected" "$dir/actual" || true
+        cat "$dir/error"
+        failed=$((failed + 1))
+    fi
+}
+
+# reject <name> <command...>, the command has to fail
+reject() {
+    name=$1
+    shift
+    if "$@" > /dev/null 2> "$dir/error"; then
+        echo "FAILED  $name, it succeeded"
+        failed=$((failed + 1))
+    else
+        echo "ok      $name"
+    fi
+}
+
+# compiles the C++ program on stdin to $dir/$1, for checks of the headers themselves
+compile() {
+    "$CXX" -std=c++17 -O1 -I. -o "$dir/$1" -x c++ -
+}
+
+# lexes the file $1 from stdin with the rest of the arguments as options
+lex_file() {
+    input=$1
+    shift
+    "$LEX" "$@" - < "$input"
+}
+
+# escaped backticks and ${ stay in the template
+printf '%s\n' 'x = `a\`c` + 1; y = `p\${q} ${r} \\`;' > "$dir/template.js"
+cat > "$dir/expected" <<'END'
+USER: x
+SYMBOL: =
+SYMBOL: `
+USER: a
+SYMBOL: \`
+USER: c
+SYMBOL: `
+SYMBOL: +
+USER: 1
+SYMBOL: ;
+USER: y
+SYMBOL: =
+SYMBOL: `
+USER: p
+SYMBOL: \$
+USER: {q} 
+SYMBOL: ${
+USER: r
+SYMBOL: }
+USER:  
+SYMBOL: \\
+SYMBOL: `
+SYMBOL: ;
+END
+expect "js template escapes" "$dir/expected" lex_file "$dir/template.js" --spec spec/js.lexspec
+
+# identifiers matched by a rule are counted, numbers and characters that aren't XID aren't
+printf 'int foo = bar + 12 * foo;\n\342\202\254 x\342\202\254 caf\303\251 _y 0x1F\n' > "$dir/stats.c"
+cat > "$dir/expected" <<'END'
+files 1
+bytes 49
+tokens 15
+kinds
+           6  IDENT
+           4  SYMBOL
+           3  USER
+           2  NUMBER
+entries
+           1  *
+           1  +
+           1  ;
+           1  =
+identifiers
+           2  foo
+           1  _y
+           1  bar
+           1  café
+           1  int
+           1  x
+END
+expect "stats with rules" "$dir/expected" lex_file "$dir/stats.c" --spec spec/c.lexspec --engine dfa --stats
+
+# the BOM of an encoding that was asked for is skipped like the one auto detects
+printf 'USER: x\nUSER: y\n' > "$dir/expected"
+printf '\357\273\277x y\n' > "$dir/bom8"
+printf '\377\376x\000 \000y\000\n\000' > "$dir/bom16le"
+printf '\376\377\000x\000 \000y\000\n' > "$dir/bom16be"
+expect "utf8 bom" "$dir/expected" lex_file "$dir/bom8" --encoding utf8
+expect "utf16le bom" "$dir/expected" lex_file "$dir/bom16le" --encoding utf16le
+expect "utf16be bom" "$dir/expected" lex_file "$dir/bom16be" --encoding utf16be
+expect "auto bom" "$dir/expected" lex_file "$dir/bom16be"
+
+# a stdin that can't be read is an error, a file name on stdin that can't be read is skipped
+reject "unreadable stdin" lex_file "$dir"
+if grep -q "failed to read" "$dir/error"; then echo "ok      unreadable stdin error"; else echo "FAILED  unreadable stdin error"; failed=$((failed + 1)); fi
+unreadable_name() { echo "$dir" | "$LEX"; }
+expect "unreadable file name on stdin" /dev/null unreadable_name
+
+# NDJSON escapes quotes, backslashes and control bytes. the second string's escape is the first
+# byte after a full 16 byte run, the start of the next SSE2 block
+printf 's = "q\\"b\\\\t\tc\001d\037e";\n"xxxxxxxxxxxxxxxx\\nxxxxxxxxxxxxxxxx";\n' > "$dir/json.c"
+cat > "$dir/expected" <<'END'
+{"kind":"USER","offset":0,"length":1,"text":"s"}
+{"kind":"SYMBOL","offset":2,"length":1,"id":20,"text":"="}
+{"kind":"STRING","offset":4,"length":15,"id":81,"text":"\"q\\\"b\\\\t\tc\u0001d\u001fe\""}
+{"kind":"SYMBOL","offset":19,"length":1,"id":42,"text":";"}
+{"kind":"STRING","offset":21,"length":36,"id":81,"text":"\"xxxxxxxxxxxxxxxx\\nxxxxxxxxxxxxxxxx\""}
+{"kind":"SYMBOL","offset":57,"length":1,"id":42,"text":";"}
+END
+expect "ndjson escapes" "$dir/expected" lex_file "$dir/json.c" --spec spec/c.lexspec --format ndjson
+
+# batches of 4 with 6 tokens, the last batch is short
+cat > "$dir/expected" <<'END'
+{"tokens":[{"kind":"USER","offset":0,"length":1},{"kind":"SYMBOL","offset":2,"length":1,"id":20},{"kind":"STRING","offset":4,"length":15,"id":81},{"kind":"SYMBOL","offset":19,"length":1,"id":42}]}
+{"tokens":[{"kind":"STRING","offset":21,"length":36,"id":81},{"kind":"SYMBOL","offset":57,"length":1,"id":42}]}
+END
+expect "ndjson batches without text" "$dir/expected" lex_file "$dir/json.c" --spec spec/c.lexspec --format ndjson --no-text --batch 4
+
+# directories are searched recursively, sorted, for the --ext extensions with or without the dot
+tree="$dir/tree"
+mkdir -p "$tree/sub/deep"
+echo a > "$tree/a.c"
+echo b > "$tree/sub/b.h"
+echo c > "$tree/sub/c.txt"
+echo d > "$tree/sub/deep/d.c"
+printf '==> %s <==\nUSER: a\n==> %s <==\nUSER: b\n==> %s <==\nUSER: d\n' \
+    "$tree/a.c" "$tree/sub/b.h" "$tree/sub/deep/d.c" > "$dir/expected"
+expect "directory with extensions" "$dir/expected" "$LEX" --ext c,.h "$tree"
+
+# a NUL separated list on stdin, in its own order
+printf '==> %s <==\nUSER: d\n==> %s <==\nUSER: c\n' "$tree/sub/deep/d.c" "$tree/sub/c.txt" > "$dir/expected"
+files0() { printf '%s\0%s\0' "$tree/sub/deep/d.c" "$tree/sub/c.txt" | "$LEX" --files0; }
+expect "nul separated file list" "$dir/expected" files0
+
+# files lexed on several threads are still written in the order they were given
+: > "$dir/expected"
+set --
+for i in 9 3 7 1 8 2 6 4 5 0 19 13 17 11 18 12 16 14 15 10; do
+    echo "f$i" > "$dir/order$i.c"
+    printf '==> %s <==\nUSER: f%s\n' "$dir/order$i.c" "$i" >> "$dir/expected"
+    set -- "$@" "$dir/order$i.c"
+done
+expect "jobs keep argument order" "$dir/expected" "$LEX" --jobs 4 "$@"
+set --
+
+# NDJSON frames each file with a file object
+printf '{"file":"%s"}\n{"kind":"USER","offset":0,"length":1,"text":"a"}\n{"file":"%s"}\n{"kind":"USER","offset":0,"length":1,"text":"b"}\n' \
+    "$tree/a.c" "$tree/sub/b.h" > "$dir/expected"
+expect "ndjson file framing" "$dir/expected" "$LEX" --format ndjson "$tree/a.c" "$tree/sub/b.h"
+
+# file names needn't be UTF-8, bytes that aren't are written as their latin-1 \u00XX escapes
+mkdir -p "$dir/names"
+bad_name="$dir/names/$(printf 'x\377\303\251"').c"
+echo a > "$bad_name"
+printf '{"file":"%s/names/x\\u00ff\303\251\\".c"}\n{"kind":"USER","offset":0,"length":1,"text":"a"}\n' "$dir" > "$dir/expected"
+expect "ndjson non utf8 file name" "$dir/expected" "$LEX" --format ndjson "$bad_name"
+
+# a path that can't be read is reported and counted, the rest are still lexed
+printf '==> %s <==\nUSER: a\n' "$tree/a.c" > "$dir/expected"
+if ! "$LEX" "$tree/a.c" "$tree/missing.c" > "$dir/actual" 2> "$dir/error" && cmp -s "$dir/expected" "$dir/actual" &&
+    grep -q "failed to read $tree/missing.c" "$dir/error" && grep -q "^1 files, .* 1 errors" "$dir/error"; then
+    echo "ok      unreadable path counted"
+else
+    echo "FAILED  unreadable path counted"
+    cat "$dir/error"
+    failed=$((failed + 1))
+fi
+
+# binary tokens read back through a pipe, which can't be mapped
+printf 'int main() { return 0; }\n' > "$dir/pipe.c"
+lex_file "$dir/pipe.c" --format binary > "$dir/pipe.lext"
+"$LEX" --read "$dir/pipe.lext" > "$dir/expected"
+read_pipe() { cat "$1" | "$LEX" --read /dev/stdin; }
+expect "read binary from a pipe" "$dir/expected" read_pipe "$dir/pipe.lext"
+
+# the header is little endian, the version is 2
+printf '02 00 00 00\n' > "$dir/expected"
+word_at() { od -A n -t x1 -j "$2" -N 4 "$1" | tr -s ' ' | sed 's/^ //'; }
+expect "binary header byte order" "$dir/expected" word_at "$dir/pipe.lext" 4
+
+# a record with a kind that isn't a token type, under a valid checksum, is rejected
+compile bad_kind <<'END'
+#include "spec.hpp"
+#include "binary.hpp"
+int main()
+{
+    lex::vocabulary_t vocab;
+    lex::load_builtin(vocab);
+    const std::string src = "x";
+    lex::binary_encoder_t encoder;
+    encoder.reset("bad", src, vocab);
+    encoder.add({(lex::token_type)6, -1, src, -1});
+    lex::writer_t out(1);
+    std::string error;
+    encoder.finish(out, error);
+}
+END
+"$dir/bad_kind" > "$dir/bad.lext"
+reject "binary record with a bad kind" "$LEX" --read "$dir/bad.lext"
+
+# sections whose sizes wrap when summed, or that stop inside the header, are errors and not crashes
+read_fails() {
+    status=0
+    "$LEX" --read "$2" > /dev/null 2> "$dir/error" || status=$?
+    if [ "$status" -eq 1 ] && [ -s "$dir/error" ]; then
+        echo "ok      $1"
+    else
+        echo "FAILED  $1, exit $status"
+        failed=$((failed + 1))
+    fi
+}
+# version 2, every count 0 but strings_size 4 and tokens_size 2^64 - 4, which sum to 0
+printf 'LEXT\002\000\000\000' > "$dir/wrapped.lext"
+printf '\000%.0s' $(seq 40) >> "$dir/wrapped.lext"
+printf '\004\000\000\000\000\000\000\000\374\377\377\377\377\377\377\377' >> "$dir/wrapped.lext"
+printf '\000%.0s' $(seq 8) >> "$dir/wrapped.lext"
+read_fails "binary sizes that wrap" "$dir/wrapped.lext"
+head -c 40 "$dir/pipe.lext" > "$dir/truncated.lext"
+read_fails "binary truncated header" "$dir/truncated.lext"
+
+# rules and ids a record can't have, under a valid checksum, are rejected
+compile bad_record <<'END'
+#include "spec.hpp"
+#include "binary.hpp"
+int main(int, char **argv)
+{
+    lex::vocabulary_t vocab;
+    lex::load_builtin(vocab);
+    const std::string src = "x";
+    lex::binary_encoder_t encoder;
+    encoder.reset("bad", src, vocab);
+    if (argv[1][0] == 'r') encoder.add({lex::token_type::USER, 0, src, -1});
+    else
+    {
+        // an id of 2^31 can't come from a token, it's spliced into the record
+        encoder.add({lex::token_type::USER, -1, src, -1});
+        encoder.records[0] |= lex::KIND_ID;
+        lak::write_varint(encoder.records, 1ULL << 31);
+    }
+    lex::writer_t out(1);
+    std::string error;
+    encoder.finish(out, error);
+}
+END
+"$dir/bad_record" rule > "$dir/bad_rule.lext"
+read_fails "binary record with a rule past the table" "$dir/bad_rule.lext"
+"$dir/bad_record" id > "$dir/bad_id.lext"
+read_fails "binary record with an id past int" "$dir/bad_id.lext"
+
+# peeking further ahead than the lookahead ring holds is an error, not the last token in it
+compile lookahead <<'END'
+#include "lex.hpp"
+#include "spec.hpp"
+int main(int, char **argv)
+{
+    auto vocab = std::make_shared<lex::vocabulary_t>();
+    lex::load_builtin(*vocab);
+    lex::lexer_t lexer(vocab, "a b c d e f g h i j");
+    lex::lookahead_t<4> ahead(lexer);
+    return ahead.peek(std::atoi(argv[1])).value == "d" ? 0 : 1;
+}
+END
+expect "lookahead within capacity" /dev/null "$dir/lookahead" 3
+reject "lookahead past capacity" "$dir/lookahead" 4
+
+# restoring a checkpoint after its history was dropped is an error, not a replay of other tokens
+compile checkpoint <<'END'
+#include "lex.hpp"
+#include "spec.hpp"
+int main(int, char **argv)
+{
+    auto vocab = std::make_shared<lex::vocabulary_t>();
+    lex::load_builtin(*vocab);
+    lex::lexer_t lexer(vocab, "a b c d");
+    const bool release = argv[1][0] == 'r';
+    const lex::checkpoint_t cp = lexer.checkpoint();
+    lexer.next();
+    if (release) lexer.release(cp);
+    const lex::checkpoint_t later = lexer.checkpoint();
+    lexer.next();
+    // released, cp's index would point at b in the history later started
+    lexer.restore(cp);
+    const bool replayed = lexer.next().value == "a";
+    lexer.release(later);
+    return release || replayed ? 0 : 1;
+}
+END
+expect "restore a held checkpoint" /dev/null "$dir/checkpoint" held
+reject "restore a released checkpoint" "$dir/checkpoint" released
+
+# a token cache hit writes what the miss did, and the entry is only written once
+cache_dir="$dir/token_cache"
+tokens="$cache_dir/tokens"
+awk 'BEGIN { for (i = 0; i < 30000; i++) print "a" i " = a" i " + 1;" }' > "$dir/cache_a.c"
+awk 'BEGIN { for (i = 0; i < 30000; i++) print "b" i " = b" i " + 2;" }' > "$dir/cache_b.c"
+cached() { LEX_CACHE_DIR="$cache_dir" lex_file "$@" --token-cache --token-cache-size 1; }
+lex_file "$dir/cache_a.c" > "$dir/expected"
+expect "token cache miss" "$dir/expected" cached "$dir/cache_a.c"
+entry_a=$(ls "$tokens"/*.lext)
+inode() { ls -i "$1" | awk '{ print $1 }'; }
+inode "$entry_a" > "$dir/inode"
+expect "token cache hit" "$dir/expected" cached "$dir/cache_a.c"
+# a miss would have renamed a new entry into place
+expect "token cache hit reads the entry" "$dir/inode" inode "$entry_a"
+count_entries() { ls "$tokens" | wc -l | tr -d ' '; }
+
+# an entry whose second source hash doesn't match is a miss, and is replaced
+hash_at() { od -A n -t x1 -j 64 -N 8 "$1"; }
+hash_at "$entry_a" > "$dir/hash"
+printf '\377\377\377\377\377\377\377\377' | dd of="$entry_a" bs=1 seek=64 conv=notrunc 2> /dev/null
+expect "token cache second hash mismatch" "$dir/expected" cached "$dir/cache_a.c"
+expect "token cache entry replaced" "$dir/hash" hash_at "$entry_a"
+
+# entries that don't fit in --token-cache-size go least recently used first, along with stale
+# temporaries. the first store of a run scans the directory
+touch -d '2 hours ago' "$tokens/stale.lext.tmp1"
+lex_file "$dir/cache_b.c" > "$dir/expected"
+expect "token cache evicting miss" "$dir/expected" cached "$dir/cache_b.c"
+if [ ! -e "$entry_a" ] && [ "$(count_entries)" = 1 ]; then
+    echo "ok      token cache evicts the oldest entry"
+else
+    echo "FAILED  token cache evicts the oldest entry"
+    failed=$((failed + 1))
+fi
+if [ ! -e "$tokens/stale.lext.tmp1" ]; then
+    echo "ok      token cache removes stale temporaries"
+else
+    echo "FAILED  token cache removes stale temporaries"
+    failed=$((failed + 1))
+fi
+
+# stats from a cache entry whose rules and ids the vocabulary doesn't have count them as neither,
+# instead of indexing past the vocabulary or sizing the counters from them
+compile planted_entry <<'END'
+#include "spec.hpp"
+#include "token_cache.hpp"
+int main(int, char **argv)
+{
+    lex::vocabulary_t vocab, planted;
+    lex::load_builtin(vocab);
+    lex::load_builtin(planted);
+    planted.rules.push_back({"planted", "x"});
+    const std::string src = "x\n";
+    lex::token_cache_t cache(std::string(argv[1]) + "/tokens", 1 << 20, vocab, "trie");
+    std::filesystem::create_directories(cache.dir);
+    lex::binary_encoder_t encoder;
+    encoder.reset("", src, planted);
+    encoder.add({lex::token_type::USER, 0, std::string_view(src).substr(0, 1), 1 << 30});
+    std::string encoded, error;
+    {
+        lex::writer_t out(encoded);
+        if (!encoder.finish(out, error)) return 1;
+    }
+    std::ofstream(cache.path(src), std::ios::binary) << encoded;
+}
+END
+printf 'x\n' > "$dir/planted.c"
+"$dir/planted_entry" "$dir/planted"
+cat > "$dir/expected" <<'END'
+files 1
+bytes 2
+tokens 1
+kinds
+           1  USER
+entries
+identifiers
+           1  x
+END
+planted_stats() { LEX_CACHE_DIR="$dir/planted" lex_file "$dir/planted.c" --stats --token-cache; }
+expect "stats from a cache entry the vocabulary can't explain" "$dir/expected" planted_stats
+# compiled tables cached under another version are rebuilt and saved again, not loaded
+LEX_CACHE_DIR="$dir/tables" lex_file "$dir/pipe.c" --spec spec/c.lexspec > "$dir/expected"
+tables=$(ls "$dir"/tables/*.lexc)
+version=$(word_at "$tables" 4)
+printf '\377\000\000\000' | dd of="$tables" bs=1 seek=4 conv=notrunc 2> /dev/null
+LEX_CACHE_DIR="$dir/tables" lex_file "$dir/pipe.c" --spec spec/c.lexspec > "$dir/actual"
+if cmp -s "$dir/expected" "$dir/actual" && [ "$(word_at "$tables" 4)" = "$version" ]; then
+    echo "ok      table cache version mismatch"
+else
+    echo "FAILED  table cache version mismatch"
+    failed=$((failed + 1))
+fi
+
+# compiled tables with a DFA that would index out of bounds aren't loaded, whatever field is bad
+compile bad_tables <<'END'
+#include "spec.hpp"
+int main(int, char **argv)
+{
+    lex::vocabulary_t vocab;
+    std::string error;
+    if (!lex::load_spec("spec/c.lexspec", false, vocab, error)) return 2;
+    const std::string field = argv[1];
+    if (field == "next") vocab.dfa.next[0] = (uint32_t)vocab.dfa.accept.size();
+    if (field == "accept") vocab.dfa.accept[0] = (int32_t)vocab.dfa.rules.size();
+    if (field == "classmap") vocab.dfa.classmap[0] = (uint8_t)vocab.dfa.nclasses;
+    if (field == "type") vocab.dfa.rules[0].type = (lex::token_type)9;
+    if (field == "rule") vocab.dfa.rules[0].rule = (int)vocab.rules.size();
+    if (field == "push") vocab.add_entry(0, "int", {lex::token_type::KEYWORD, -1, (int16_t)vocab.modes.size()});
+    const std::filesystem::path path = argv[2];
+    lex::vocabulary_t loaded;
+    return lex::save_tables(path, vocab) && lex::load_tables(path, loaded) ? 0 : 1;
+}
+END
+expect "load valid tables" /dev/null "$dir/bad_tables" none "$dir/tables.lexc"
+for field in next accept classmap type rule push; do
+    reject "tables with a bad $field" "$dir/bad_tables" $field "$dir/tables.lexc"
+done
+
+# a corpus seed gives the same bytes with every compiler and standard library
+compile corpus <<'END'
+#include "spec.hpp"
+#include "corpus.hpp"
+#include <cstdio>
+int main()
+{
+    lex::vocabulary_t vocab;
+    std::string error;
+    if (!lex::load_spec("spec/c.lexspec", false, vocab, error)) return 2;
+    lex::corpus_options_t options;
+    options.seed = 7;
+    options.operator_skew = 1.5;
+    lex::corpus_generator_t generator(vocab, options);
+    std::string out;
+    generator.generate(out, 1 << 16);
+    std::printf("%zu %016llx\n", out.size(), (unsigned long long)lak::fnv1a(out.data(), out.size()));
+}
+END
+echo "65559 cbfb6eeaadb12c83" > "$dir/expected"
+expect "corpus bytes for a seed" "$dir/expected" "$dir/corpus"
+
+if [ "$failed" -gt 0 ]; then
+    echo "$failed failed"
+    exit 1
+fi
@@ -0,0 +1,43 @@
+#!/bin/sh
+# end to end throughput of the lex CLI, tokens written to /dev/null and to a file, and
+# the source piped in on stdin
+#   LEX=./lex SIZE_MB=64 REPS=3 SEED=1 CORPUS_ARGS='--spec spec/c.lexspec' ./cli_bench.sh [lex options...]
+set -e
+
+LEX=${LEX:-./lex}
+LEXCORPUS=${LEXCORPUS:-./lexcorpus}
+SEED=${SEED:-1}
+SIZE_MB=${SIZE_MB:-64}
+REPS=${REPS:-3}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# a generated corpus, the same for the same SIZE_MB, SEED and CORPUS_ARGS
+"$LEXCORPUS" --size "${SIZE_MB}M" --seed "$SEED" $CORPUS_ARGS > "$dir/input.c"
+bytes=$(wc -c < "$dir/input.c")
+
+# best of REPS runs, prints MB/s of input
+run() {
+    best=""
+    i=0
+    while [ "$i" -lt "$REPS" ]; do
+        start=$(date +%s.%N)
+        if [ "$pipe" = 1 ]; then
+            cat "$dir/input.c" | "$LEX" "$@" - > "$out"
+        else
+            echo "$dir/input.c" | "$LEX" "$@" > "$out"
+        fi
+        end=$(date +%s.%N)
+        best=$(echo "$start $end $best" | awk '{ t = $2 - $1; if ($3 == "" || t < $3) print t; else print $3 }')
+        i=$((i + 1))
+    done
+    echo "$best"
+}
+
+for target in /dev/null file pipe; do
+    if [ "$target" = file ]; then out="$dir/tokens.txt"; else out=/dev/null; fi
+    if [ "$target" = pipe ]; then pipe=1; else pipe=0; fi
+    seconds=$(run "$@")
+    echo "$bytes $seconds $target" | awk '{ printf "%-10s %8.1f MB/s %8.3f s\n", $3, $1 / $2 / 1e6, $2 }'
+done
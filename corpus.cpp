@@ -0,0 +1,108 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// lexcorpus writes reproducible source like text for benchmarks, the same arguments always
+// give the same bytes
+
+#include "lex.hpp"
+#include "dfa.hpp"
+#include "spec.hpp"
+#include "writer.hpp"
+#include "corpus.hpp"
+
+using std::cerr;
+using std::string;
+using namespace std::string_literals;
+
+// a byte count with an optional K, M or G suffix
+static bool parse_size(const char *str, uint64_t &size)
+{
+    char *end;
+    size = std::strtoull(str, &end, 10);
+    switch (*end)
+    {
+        case 'k': case 'K': size <<= 10; ++end; break;
+        case 'm': case 'M': size <<= 20; ++end; break;
+        case 'g': case 'G': size <<= 30; ++end; break;
+        default: break;
+    }
+    return end != str && *end == '\0';
+}
+
+int main(int argc, char **argv)
+{
+    string spec;
+    uint64_t size = 64 << 20;
+    lex::corpus_options_t options;
+    bool ok = true;
+    for (int i = 1; i < argc && ok; ++i)
+    {
+        const bool value = i + 1 < argc;
+        if (argv[i] == "--spec"s && value) spec = argv[++i];
+        else if (argv[i] == "--size"s && value) ok = parse_size(argv[++i], size);
+        else if (argv[i] == "--seed"s && value) options.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (argv[i] == "--ident-mean"s && value) options.ident_mean = std::atof(argv[++i]);
+        else if (argv[i] == "--ident-min"s && value) options.ident_min = std::strtoul(argv[++i], nullptr, 10);
+        else if (argv[i] == "--ident-max"s && value) options.ident_max = std::strtoul(argv[++i], nullptr, 10);
+        else if (argv[i] == "--keywords"s && value) options.keywords = std::atof(argv[++i]);
+        else if (argv[i] == "--operators"s && value) options.operators = std::atof(argv[++i]);
+        else if (argv[i] == "--operator-skew"s && value) options.operator_skew = std::atof(argv[++i]);
+        else if (argv[i] == "--numbers"s && value) options.numbers = std::atof(argv[++i]);
+        else if (argv[i] == "--strings"s && value) options.strings = std::atof(argv[++i]);
+        else if (argv[i] == "--string-mean"s && value) options.string_mean = std::atof(argv[++i]);
+        else if (argv[i] == "--comments"s && value) options.comments = std::atof(argv[++i]);
+        else if (argv[i] == "--line-mean"s && value) options.line_mean = std::atof(argv[++i]);
+        else ok = false;
+    }
+    if (!ok)
+    {
+        cerr << "usage: " << argv[0] << " [--spec file] [--size bytes[K|M|G]] [--seed n]\n"
+            "    [--ident-mean n] [--ident-min n] [--ident-max n] [--keywords ratio]\n"
+            "    [--operators ratio] [--operator-skew s] [--numbers ratio] [--strings ratio]\n"
+            "    [--string-mean n] [--comments ratio] [--line-mean n] > corpus\n";
+        return 1;
+    }
+
+    lex::vocabulary_t vocab;
+    if (spec.empty())
+        lex::load_builtin(vocab);
+    else if (string error; !lex::load_spec(spec, true, vocab, error))
+    {
+        cerr << error << '\n';
+        return 1;
+    }
+
+    // a chunk at a time so the size is only limited by the disk
+    lex::corpus_generator_t generator(vocab, options);
+    lex::writer_t out(1);
+    string chunk;
+    for (uint64_t written = 0; written < size && !out.failed;)
+    {
+        chunk.clear();
+        generator.generate(chunk, (size_t)std::min<uint64_t>(size - written, 1 << 20));
+        out.write(chunk);
+        written += chunk.size();
+    }
+    return out.flush() ? 0 : 1;
+}
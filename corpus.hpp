@@ -0,0 +1,278 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_CORPUS_HPP
+#define LEX_CORPUS_HPP
+
+#include "lex.hpp"
+
+#include <cmath>
+#include <functional>
+
+namespace lex
+{
+    // the shape of generated source. ratios are per token unless they say otherwise
+    struct corpus_options_t
+    {
+        uint64_t seed = 1;
+        double ident_mean = 7;     // identifier length, geometric between min and max
+        size_t ident_min = 1;
+        size_t ident_max = 32;
+        double keywords = 0.15;    // of words, a keyword instead of an identifier
+        double operators = 0.35;   // tokens that are operators
+        double operator_skew = 1;  // zipf exponent over the vocabulary's symbols in entry order, 0 is uniform
+        double numbers = 0.08;
+        double strings = 0.03;
+        double string_mean = 16;   // characters in a string literal
+        double comments = 0.1;     // of lines, a comment instead of code
+        double line_mean = 60;     // characters in a line of code
+    };
+
+    // x^s from squaring for the whole part of s and a chain of square roots for the fraction.
+    // unlike std::pow, which libms round differently, every step is a correctly rounded IEEE
+    // operation so the result is the same everywhere
+    static inline double rounded_pow(double x, double s)
+    {
+        if (s < 0) return 1 / rounded_pow(x, -s);
+        double rtn = 1;
+        uint64_t whole = (uint64_t)s;
+        double frac = s - (double)whole;
+        for (double square = x; whole > 0; whole >>= 1, square *= square)
+            if (whole & 1) rtn *= square;
+        for (double root = x; frac > 0 && root != 1;)
+        {
+            root = std::sqrt(root);
+            frac *= 2;
+            if (frac >= 1)
+            {
+                rtn *= root;
+                frac -= 1;
+            }
+        }
+        return rtn;
+    }
+
+    // min plus a geometric count with the given mean, capped at max. thresholds[k - 1] is
+    // (1 - p)^k in 53 bit fixed point, built by multiplication alone, and the count is how
+    // many of them a uniform draw is at or below
+    struct geometric_t
+    {
+        size_t min = 0;
+        vector<uint64_t> thresholds; // decreasing
+
+        geometric_t() {}
+        geometric_t(double mean, size_t lo, size_t hi) : min(lo)
+        {
+            const double q = 1 - 1 / std::max(mean - (double)lo + 1, 1.0);
+            double tail = 1;
+            for (size_t k = lo; k < hi; ++k)
+            {
+                tail *= q;
+                const uint64_t threshold = (uint64_t)(tail * 9007199254740992.0);
+                if (threshold == 0) break;
+                thresholds.push_back(threshold);
+            }
+        }
+
+        // draw is uniform in [0, 2^53)
+        inline size_t operator()(uint64_t draw) const
+        {
+            return min + (std::upper_bound(thresholds.begin(), thresholds.end(), draw, std::greater<uint64_t>()) - thresholds.begin());
+        }
+    };
+
+    // source like text for a vocabulary from a seed, the same seed and options give the same bytes
+    // on every platform. sampling is integer or table based, with no libm calls, so it doesn't
+    // depend on how a standard library rounds. keywords, operators and the comment and string
+    // delimiters all come from the vocabulary's main mode. generation is streamed so any size can
+    // be made a chunk at a time
+    struct corpus_generator_t
+    {
+        corpus_options_t options;
+        vector<string> keywords;
+        vector<string> operators;
+        vector<uint64_t> operator_weights; // cumulative, in 32 bit fixed point relative to the heaviest
+        vector<std::pair<string, delimiter_t>> line_comments, block_comments, strings;
+        geometric_t ident_lengths, string_lengths, comment_words;
+        uint64_t state;
+        size_t line = 0;  // characters in the current line
+        size_t target = 0; // length the current line is heading for
+        size_t depth = 0;
+
+        corpus_generator_t(const vocabulary_t &vocab, const corpus_options_t &opt) : options(opt), state(opt.seed)
+        {
+            // entry order rather than trie order so the mix doesn't depend on how the trie was built
+            const mode_t &mode = vocab.modes[0];
+            for (const string &entry : vocab.entries)
+            {
+                const auto *node = mode.tokens.find(entry);
+                if (node == nullptr || node->values.empty()) continue;
+                const entry_t &value = node->values[0];
+                if (value.push >= 0 || value.pop) continue;
+                if (auto it = mode.delimiters.find(entry); it != mode.delimiters.end())
+                {
+                    if (value.type == token_type::STRING) strings.emplace_back(entry, it->second);
+                    else if (it->second.close == "\n") line_comments.emplace_back(entry, it->second);
+                    else block_comments.emplace_back(entry, it->second);
+                }
+                else if (value.type == token_type::KEYWORD) keywords.push_back(entry);
+                else if (value.type == token_type::SYMBOL) operators.push_back(entry);
+            }
+            vector<double> weights;
+            for (size_t i = 0; i < operators.size(); ++i)
+                weights.push_back(1 / rounded_pow((double)(i + 1), options.operator_skew));
+            const double heaviest = weights.empty() ? 1 : *std::max_element(weights.begin(), weights.end());
+            uint64_t total = 0;
+            for (double weight : weights)
+                operator_weights.push_back(total += std::max<uint64_t>((uint64_t)(weight / heaviest * 4294967296.0), 1));
+
+            const size_t ident_min = std::max<size_t>(options.ident_min, 1);
+            ident_lengths = geometric_t(options.ident_mean, ident_min, std::max(options.ident_max, ident_min));
+            string_lengths = geometric_t(options.string_mean, 0, 1 << 16);
+            comment_words = geometric_t(8, 1, 64);
+            next_line();
+        }
+
+        // splitmix64, defined everywhere unlike the std distributions
+        inline uint64_t next()
+        {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+        inline double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+        inline size_t below(size_t n) { return n > 0 ? (size_t)(uniform() * n) : 0; }
+        inline bool chance(double p) { return uniform() < p; }
+
+        inline size_t length(const geometric_t &distribution) { return distribution(next() >> 11); }
+
+        void next_line()
+        {
+            line = 0;
+            target = (size_t)(options.line_mean * (0.5 + uniform()));
+            depth = below(4);
+        }
+
+        void add_identifier(string &out)
+        {
+            static const char first[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+            static const char rest[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+            const size_t len = length(ident_lengths);
+            out += first[below(sizeof(first) - 1)];
+            for (size_t i = 1; i < len; ++i)
+                out += rest[below(sizeof(rest) - 1)];
+        }
+
+        void add_words(string &out, size_t count, bool lines)
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                out += i > 0 && lines && chance(0.1) ? '\n' : ' ';
+                add_identifier(out);
+            }
+        }
+
+        void add_string(string &out)
+        {
+            const auto &[open, delim] = strings[below(strings.size())];
+            out += open;
+            for (size_t len = length(string_lengths); len-- > 0;)
+            {
+                if (delim.escape != 0 && chance(0.05))
+                {
+                    out += delim.escape;
+                    out += 'n';
+                }
+                else
+                {
+                    char c = (char)(' ' + below(95));
+                    if (c == delim.escape || delim.close.find(c) != string::npos) c = ' ';
+                    out += c;
+                }
+            }
+            out += delim.close;
+        }
+
+        void add_token(string &out)
+        {
+            double roll = uniform();
+            if (roll < options.operators && !operators.empty())
+            {
+                const uint64_t pick = next() % operator_weights.back();
+                out += operators[std::upper_bound(operator_weights.begin(), operator_weights.end(), pick) - operator_weights.begin()];
+            }
+            else if ((roll -= options.operators) < options.numbers)
+                out += std::to_string(next() % (chance(0.8) ? 100 : 1000000));
+            else if ((roll -= options.numbers) < options.strings && !strings.empty())
+                add_string(out);
+            else if (chance(options.keywords) && !keywords.empty())
+                out += keywords[below(keywords.size())];
+            else
+                add_identifier(out);
+        }
+
+        // appends at least size bytes of source to out, ending on a line break
+        void generate(string &out, size_t size)
+        {
+            const size_t end = out.size() + size;
+            while (out.size() < end)
+            {
+                if (line == 0)
+                {
+                    out.append(depth * 4, ' ');
+                    if (chance(options.comments) && !(line_comments.empty() && block_comments.empty()))
+                    {
+                        const bool block = line_comments.empty() || (!block_comments.empty() && chance(0.3));
+                        const auto &[open, delim] = block ? block_comments[below(block_comments.size())] : line_comments[below(line_comments.size())];
+                        out += open;
+                        add_words(out, length(comment_words), block);
+                        out += ' ';
+                        out += delim.close;
+                        if (block) out += '\n';
+                        next_line();
+                        continue;
+                    }
+                }
+                const size_t before = out.size();
+                if (line > 0) out += ' ';
+                add_token(out);
+                line += out.size() - before;
+                if (line >= target)
+                {
+                    out += '\n';
+                    next_line();
+                }
+            }
+            if (line > 0)
+            {
+                out += '\n';
+                next_line();
+            }
+        }
+    };
+}
+
+#endif
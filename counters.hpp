@@ -0,0 +1,218 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_COUNTERS_HPP
+#define LEX_COUNTERS_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#ifdef LEX_COUNTERS
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#endif
+
+// performance counters, compiled in with -DLEX_COUNTERS (make COUNTERS=1). without it count()
+// is an empty inline function and every call to it disappears
+
+namespace lex
+{
+    enum counter_t : size_t
+    {
+        COUNT_TOKENS,          // tokens lexed, not counting replays or comments
+        COUNT_TOKEN_BYTES,     // source bytes lexed, with the whitespace and comments between tokens
+        COUNT_USER,            // tokens by kind, in token_type order, see count_kind
+        COUNT_KEYWORDS,
+        COUNT_SYMBOLS,
+        COUNT_STRINGS,
+        COUNT_COMMENTS,        // comments skipped
+        COUNT_IDENTIFIERS,     // words scanned by class and then probed
+        COUNT_TRIE_PROBES,     // exact lookups in a mode's trie
+        COUNT_LONGEST_MATCHES, // longest match walks down a mode's trie
+        COUNT_TRIE_NODES,      // nodes visited by lookups and walks
+        COUNT_DFA_MATCHES,     // runs of the DFA
+        COUNT_UNKNOWN,         // tokens that matched nothing
+        COUNT_MODE_SWITCHES,   // pushes and pops
+        COUNT_REPLAYS,         // tokens returned again after a restore
+        COUNT_LOOKAHEAD_PEEKS, // lookahead_t records asked for
+        COUNT_LOOKAHEAD_FILLS, // times the lookahead ring had to lex more tokens
+        COUNT_READS,           // read system calls refilling input buffers
+        COUNT_READ_BYTES,
+        COUNT_WRITES,          // write system calls by writer_t
+        COUNT_WRITE_BYTES,
+        COUNT_ALLOCATIONS,     // buffers allocated or grown while lexing and writing
+        COUNT_CACHE_HITS,      // token cache
+        COUNT_CACHE_MISSES,
+        COUNTER_COUNT
+    };
+
+    static const char *const counter_names[COUNTER_COUNT] = {
+        "tokens", "token_bytes", "user", "keywords", "symbols", "strings", "comments", "identifiers",
+        "trie_probes", "longest_matches", "trie_nodes", "dfa_matches", "unknown", "mode_switches", "replays",
+        "lookahead_peeks", "lookahead_fills", "reads", "read_bytes", "writes", "write_bytes", "allocations",
+        "cache_hits", "cache_misses"
+    };
+
+    // every counter summed over all threads at some point in time
+    struct counters_t
+    {
+        uint64_t values[COUNTER_COUNT] = {};
+
+        uint64_t operator[](counter_t counter) const { return values[counter]; }
+
+        // the counts between two snapshots
+        counters_t operator-(const counters_t &other) const
+        {
+            counters_t rtn;
+            for (size_t i = 0; i < COUNTER_COUNT; ++i)
+                rtn.values[i] = values[i] - other.values[i];
+            return rtn;
+        }
+    };
+
+#ifdef LEX_COUNTERS
+    static constexpr bool counters_enabled = true;
+
+    // each thread counts into a block of its own with plain loads and stores, so counting never
+    // contends or locks the bus. the atomics only make snapshots from other threads well defined.
+    // the block is trivial so it's zero initialized thread local storage, reached without a call
+    struct counter_block_t
+    {
+        std::atomic<uint64_t> values[COUNTER_COUNT];
+        bool registered;
+    };
+
+    inline thread_local counter_block_t counter_block;
+
+    struct counter_registry_t
+    {
+        std::mutex mutex;
+        std::vector<counter_block_t *> blocks;
+        counters_t retired; // what threads that have exited counted
+    };
+
+    inline counter_registry_t &counter_registry()
+    {
+        static counter_registry_t registry;
+        return registry;
+    }
+
+    // the first count on a thread adds its block to the registry, and moves the counts to
+    // retired when the thread exits. kept out of line so count() stays a few instructions
+    [[gnu::noinline]] inline void register_counter_block()
+    {
+        struct retire_t
+        {
+            ~retire_t()
+            {
+                counter_registry_t &registry = counter_registry();
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                for (size_t i = 0; i < COUNTER_COUNT; ++i)
+                    registry.retired.values[i] += counter_block.values[i].load(std::memory_order_relaxed);
+                registry.blocks.erase(std::find(registry.blocks.begin(), registry.blocks.end(), &counter_block));
+            }
+        };
+        thread_local retire_t retire;
+        counter_registry_t &registry = counter_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.blocks.push_back(&counter_block);
+        counter_block.registered = true;
+    }
+
+    inline void count(counter_t counter, uint64_t n = 1)
+    {
+        if (!counter_block.registered)
+            register_counter_block();
+        std::atomic<uint64_t> &value = counter_block.values[counter];
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // counts kept in plain fields by something that counts several things per token, like
+    // lexer_t, and added to the thread's block in one go by flush() and on destruction. a copy
+    // starts empty and unmarked so nothing is counted twice
+    struct counter_batch_t
+    {
+        uint64_t values[COUNTER_COUNT] = {};
+        const char *position = nullptr; // COUNT_TOKEN_BYTES has been counted up to here
+
+        counter_batch_t() {}
+        counter_batch_t(const counter_batch_t &) {}
+        counter_batch_t &operator=(const counter_batch_t &) { position = nullptr; return *this; }
+        ~counter_batch_t() { flush(); }
+
+        inline void add(counter_t counter, uint64_t n = 1) { values[counter] += n; }
+        inline uint64_t get(counter_t counter) const { return values[counter]; }
+
+        // token bytes are counted from where a source was marked to where it's got to
+        inline void mark(const char *at) { position = at; }
+        inline void count_bytes(const char *at)
+        {
+            if (position != nullptr) values[COUNT_TOKEN_BYTES] += at - position;
+            position = at;
+        }
+
+        void flush()
+        {
+            if (!counter_block.registered)
+                register_counter_block();
+            for (size_t i = 0; i < COUNTER_COUNT; ++i)
+            {
+                std::atomic<uint64_t> &value = counter_block.values[i];
+                value.store(value.load(std::memory_order_relaxed) + values[i], std::memory_order_relaxed);
+                values[i] = 0;
+            }
+        }
+    };
+
+    inline counters_t counters_snapshot()
+    {
+        counter_registry_t &registry = counter_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        counters_t rtn = registry.retired;
+        for (const counter_block_t *block : registry.blocks)
+            for (size_t i = 0; i < COUNTER_COUNT; ++i)
+                rtn.values[i] += block->values[i].load(std::memory_order_relaxed);
+        return rtn;
+    }
+#else
+    static constexpr bool counters_enabled = false;
+
+    inline void count(counter_t, uint64_t = 1) {}
+
+    struct counter_batch_t
+    {
+        inline void add(counter_t, uint64_t = 1) {}
+        inline uint64_t get(counter_t) const { return 0; }
+        inline void mark(const char *) {}
+        inline void count_bytes(const char *) {}
+        void flush() {}
+    };
+
+    inline counters_t counters_snapshot() { return {}; }
+#endif
+}
+
+#endif
@@ -0,0 +1,621 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_DFA_HPP
+#define LEX_DFA_HPP
+
+#include "lex.hpp"
+
+#include <bitset>
+#include <map>
+#include <algorithm>
+
+namespace lex
+{
+    using std::bitset;
+    using std::string_view;
+
+    // regex syntax tree
+    struct regex_t
+    {
+        enum op_t { SET, CAT, ALT, REPEAT };
+        static const size_t unbounded = SIZE_MAX;
+
+        op_t op = CAT;
+        bitset<256> set;        // SET
+        vector<regex_t> nodes;  // CAT, ALT, REPEAT (one node)
+        size_t min = 0, max = 0; // REPEAT
+
+        regex_t() {}
+        regex_t(op_t o) : op(o) {}
+        regex_t(const bitset<256> &s) : op(SET), set(s) {}
+    };
+
+    // recursive descent parser for flex style regexes
+    // supports literals, . [] [^] () | * + ? {n} {n,} {n,m} and \d \w \s \D \W \S \n \t \r \v \f \0 \xHH
+    struct regex_parser_t
+    {
+        const string &str;
+        size_t pos = 0;
+        string error;
+
+        regex_parser_t(const string &s) : str(s) {}
+
+        bool fail(const string &msg)
+        {
+            error = msg + " at offset " + std::to_string(pos);
+            return false;
+        }
+
+        bool escape(bitset<256> &set)
+        {
+            if (pos >= str.size()) return fail("trailing \\");
+            char c = str[pos++];
+            switch (c)
+            {
+                case 'd': case 'D': for (int i = '0'; i <= '9'; ++i) set[i] = true; break;
+                case 'w': case 'W':
+                {
+                    for (int i = 0; i < 256; ++i)
+                        set[i] = is_alphanumeric((char)i) || i == '_';
+                } break;
+                case 's': case 'S': for (char s : string(" \t\n\r\v\f")) set[(uint8_t)s] = true; break;
+                case 'n': set['\n'] = true; break;
+                case 'r': set['\r'] = true; break;
+                case 't': set['\t'] = true; break;
+                case 'v': set['\v'] = true; break;
+                case 'f': set['\f'] = true; break;
+                case '0': set[0] = true; break;
+                case 'x':
+                {
+                    if (pos + 2 > str.size() || !is_hex(str[pos]) || !is_hex(str[pos+1]))
+                        return fail("bad \\x escape");
+                    set[std::stoi(str.substr(pos, 2), nullptr, 16)] = true;
+                    pos += 2;
+                } break;
+                default: set[(uint8_t)c] = true; break;
+            }
+            if (c == 'D' || c == 'W' || c == 'S') set.flip();
+            return true;
+        }
+
+        // the byte in set if it only has one, otherwise -1
+        static int single(const bitset<256> &set)
+        {
+            if (set.count() != 1) return -1;
+            int rtn = 0;
+            while (!set[rtn]) ++rtn;
+            return rtn;
+        }
+
+        bool bracket(bitset<256> &set)
+        {
+            // opening [ already consumed
+            bool negate = pos < str.size() && str[pos] == '^';
+            if (negate) ++pos;
+            for (bool first = true; ; first = false)
+            {
+                if (pos >= str.size()) return fail("unterminated [");
+                if (str[pos] == ']' && !first) { ++pos; break; }
+
+                bitset<256> item;
+                int lo = (uint8_t)str[pos];
+                if (str[pos++] == '\\')
+                {
+                    if (!escape(item)) return false;
+                    lo = single(item);
+                }
+                else item[lo] = true;
+
+                if (lo >= 0 && pos + 1 < str.size() && str[pos] == '-' && str[pos+1] != ']')
+                {
+                    // range
+                    ++pos;
+                    bitset<256> hi_item;
+                    int hi = (uint8_t)str[pos];
+                    if (str[pos++] == '\\')
+                    {
+                        if (!escape(hi_item)) return false;
+                        hi = single(hi_item);
+                    }
+                    if (hi < lo) return fail("bad range");
+                    for (int i = lo; i <= hi; ++i) item[i] = true;
+                }
+                set |= item;
+            }
+            if (negate) set.flip();
+            return true;
+        }
+
+        bool atom(regex_t &rtn)
+        {
+            char c = str[pos++];
+            switch (c)
+            {
+                case '(':
+                {
+                    if (!alt(rtn)) return false;
+                    if (pos >= str.size() || str[pos] != ')') return fail("expected )");
+                    ++pos;
+                } break;
+                case '[': rtn = regex_t(regex_t::SET); return bracket(rtn.set);
+                case '\\': rtn = regex_t(regex_t::SET); return escape(rtn.set);
+                case '.': rtn = regex_t(bitset<256>().set().reset('\n')); break;
+                case '*': case '+': case '?': case '{': --pos; return fail("nothing to repeat");
+                default: rtn = regex_t(bitset<256>().set((uint8_t)c)); break;
+            }
+            return true;
+        }
+
+        bool number(size_t &n)
+        {
+            size_t start = pos;
+            for (n = 0; pos < str.size() && is_number(str[pos]) && n < 1000; ++pos)
+                n = n * 10 + (str[pos] - '0');
+            return pos > start && n < 1000;
+        }
+
+        bool repeat(regex_t &rtn)
+        {
+            if (!atom(rtn)) return false;
+            while (pos < str.size())
+            {
+                regex_t rep(regex_t::REPEAT);
+                switch (str[pos])
+                {
+                    case '*': rep.min = 0; rep.max = regex_t::unbounded; break;
+                    case '+': rep.min = 1; rep.max = regex_t::unbounded; break;
+                    case '?': rep.min = 0; rep.max = 1; break;
+                    case '{':
+                    {
+                        ++pos;
+                        if (!number(rep.min)) return fail("bad repeat count");
+                        rep.max = rep.min;
+                        if (pos < str.size() && str[pos] == ',')
+                        {
+                            ++pos;
+                            rep.max = regex_t::unbounded;
+                            if (pos < str.size() && str[pos] != '}' && (!number(rep.max) || rep.max < rep.min))
+                                return fail("bad repeat count");
+                        }
+                        if (pos >= str.size() || str[pos] != '}') return fail("expected }");
+                    } break;
+                    default: return true;
+                }
+                ++pos;
+                rep.nodes.push_back(std::move(rtn));
+                rtn = std::move(rep);
+            }
+            return true;
+        }
+
+        bool cat(regex_t &rtn)
+        {
+            rtn = regex_t(regex_t::CAT);
+            while (pos < str.size() && str[pos] != '|' && str[pos] != ')')
+            {
+                rtn.nodes.emplace_back();
+                if (!repeat(rtn.nodes.back())) return false;
+            }
+            return true;
+        }
+
+        bool alt(regex_t &rtn)
+        {
+            rtn = regex_t(regex_t::ALT);
+            do
+            {
+                rtn.nodes.emplace_back();
+                if (!cat(rtn.nodes.back())) return false;
+            } while (pos < str.size() && str[pos] == '|' && ++pos);
+            return true;
+        }
+    };
+
+    static inline bool parse_regex(const string &str, regex_t &rtn, string &error)
+    {
+        regex_parser_t parser(str);
+        if (!parser.alt(rtn) || (parser.pos < str.size() && !parser.fail("unexpected )")))
+        {
+            error = parser.error;
+            return false;
+        }
+        return true;
+    }
+
+    static inline regex_t literal_regex(const string &str)
+    {
+        regex_t rtn(regex_t::CAT);
+        for (char c : str)
+            rtn.nodes.emplace_back(bitset<256>().set((uint8_t)c));
+        return rtn;
+    }
+
+    using utf8_sequence_t = vector<std::pair<uint8_t, uint8_t>>;
+
+    // splits the code points [lo, hi] into sequences of UTF-8 byte ranges, the same way RE2 does
+    static inline void utf8_sequences(uint32_t lo, uint32_t hi, vector<utf8_sequence_t> &out)
+    {
+        vector<std::pair<uint32_t, uint32_t>> stack = {{lo, hi}};
+        while (stack.size() > 0)
+        {
+            auto [start, end] = stack.back();
+            stack.pop_back();
+            for (bool split = true; split;)
+            {
+                split = false;
+                if (start <= 0xDFFF && end >= 0xD800)
+                {
+                    // surrogates aren't valid UTF-8
+                    if (end > 0xDFFF) stack.push_back({0xE000, end});
+                    if (start >= 0xD800) break;
+                    end = 0xD7FF;
+                }
+                // one sequence length at a time
+                for (uint32_t max : {0x7Fu, 0x7FFu, 0xFFFFu})
+                {
+                    if (start <= max && max < end)
+                    {
+                        stack.push_back({max + 1, end});
+                        end = max;
+                    }
+                }
+                // then split until every continuation byte covers a whole range
+                for (int i = 1; i < 4 && !split; ++i)
+                {
+                    const uint32_t m = (1u << (6 * i)) - 1;
+                    if ((start & ~m) == (end & ~m)) continue;
+                    if ((start & m) != 0)
+                    {
+                        stack.push_back({(start | m) + 1, end});
+                        end = start | m;
+                        split = true;
+                    }
+                    else if ((end & m) != m)
+                    {
+                        stack.push_back({end & ~m, end});
+                        end = (end & ~m) - 1;
+                        split = true;
+                    }
+                }
+                if (split) continue;
+
+                char a[4], b[4];
+                const size_t length = encode_utf8(start, a);
+                encode_utf8(end, b);
+                utf8_sequence_t seq;
+                for (size_t i = 0; i < length; ++i)
+                    seq.push_back({(uint8_t)a[i], (uint8_t)b[i]});
+                out.push_back(seq);
+            }
+        }
+    }
+
+    // sequences sharing a leading byte range share a branch, which keeps the NFA small
+    static inline regex_t utf8_regex(vector<utf8_sequence_t> &seqs, size_t depth, size_t begin, size_t end)
+    {
+        regex_t rtn(regex_t::ALT);
+        for (size_t i = begin; i < end;)
+        {
+            size_t j = i;
+            while (j < end && seqs[j][depth] == seqs[i][depth]) ++j;
+            regex_t branch(regex_t::CAT);
+            branch.nodes.emplace_back(regex_t::SET);
+            for (int c = seqs[i][depth].first; c <= seqs[i][depth].second; ++c)
+                branch.nodes[0].set[c] = true;
+            if (seqs[i].size() > depth + 1)
+                branch.nodes.push_back(utf8_regex(seqs, depth + 1, i, j));
+            rtn.nodes.push_back(std::move(branch));
+            i = j;
+        }
+        return rtn;
+    }
+
+    static inline regex_t utf8_regex(const uint32_t (*ranges)[2], size_t count)
+    {
+        vector<utf8_sequence_t> seqs;
+        for (size_t i = 0; i < count; ++i)
+            utf8_sequences(ranges[i][0], ranges[i][1], seqs);
+        std::sort(seqs.begin(), seqs.end());
+        return utf8_regex(seqs, 0, 0, seqs.size());
+    }
+
+    // Thompson NFA, every state has at most one byte set transition plus any number of epsilons
+    struct nfa_t
+    {
+        struct state_t
+        {
+            bitset<256> set;
+            int next = -1;
+            int accept = -1;
+            vector<int> eps;
+        };
+        vector<state_t> states;
+
+        int add()
+        {
+            states.emplace_back();
+            return (int)states.size() - 1;
+        }
+
+        // returns the {start, end} states of the fragment for node
+        std::pair<int, int> build(const regex_t &node)
+        {
+            switch (node.op)
+            {
+                case regex_t::SET:
+                {
+                    int start = add(), end = add();
+                    states[start].set = node.set;
+                    states[start].next = end;
+                    return {start, end};
+                }
+                case regex_t::CAT:
+                {
+                    int start = add(), end = start;
+                    for (const regex_t &child : node.nodes)
+                    {
+                        auto [s, e] = build(child);
+                        states[end].eps.push_back(s);
+                        end = e;
+                    }
+                    return {start, end};
+                }
+                case regex_t::ALT:
+                {
+                    int start = add(), end = add();
+                    for (const regex_t &child : node.nodes)
+                    {
+                        auto [s, e] = build(child);
+                        states[start].eps.push_back(s);
+                        states[e].eps.push_back(end);
+                    }
+                    return {start, end};
+                }
+                case regex_t::REPEAT:
+                {
+                    int start = add(), cur = start;
+                    for (size_t i = 0; i < node.min; ++i)
+                    {
+                        auto [s, e] = build(node.nodes[0]);
+                        states[cur].eps.push_back(s);
+                        cur = e;
+                    }
+                    int end = add();
+                    if (node.max == regex_t::unbounded)
+                    {
+                        auto [s, e] = build(node.nodes[0]);
+                        states[cur].eps.push_back(s);
+                        states[e].eps.push_back(s);
+                        states[e].eps.push_back(end);
+                    }
+                    else for (size_t i = node.min; i < node.max; ++i)
+                    {
+                        auto [s, e] = build(node.nodes[0]);
+                        states[cur].eps.push_back(s);
+                        states[cur].eps.push_back(end);
+                        cur = e;
+                    }
+                    states[cur].eps.push_back(end);
+                    return {start, end};
+                }
+            }
+            return {add(), add()};
+        }
+
+        // seen[s] == pass marks states already in the current closure
+        vector<uint32_t> seen;
+        uint32_t pass = 0;
+
+        void closure(vector<int> &set)
+        {
+            seen.resize(states.size(), 0);
+            ++pass;
+            vector<int> stack = set;
+            set.clear();
+            while (stack.size() > 0)
+            {
+                int s = stack.back();
+                stack.pop_back();
+                if (seen[s] == pass) continue;
+                seen[s] = pass;
+                set.push_back(s);
+                for (int e : states[s].eps)
+                    if (seen[e] != pass) stack.push_back(e);
+            }
+            std::sort(set.begin(), set.end());
+        }
+    };
+
+    // regexes are compiled in priority order, when two rules match the same length the first one wins
+    static inline bool build_dfa(dfa_t &rtn, const vector<std::pair<regex_t, dfa_rule_t>> &regexes)
+    {
+        nfa_t nfa;
+        int start = nfa.add();
+        for (size_t i = 0; i < regexes.size(); ++i)
+        {
+            auto [s, e] = nfa.build(regexes[i].first);
+            nfa.states[start].eps.push_back(s);
+            nfa.states[e].accept = (int)i;
+        }
+
+        // partition bytes into classes that no transition can tell apart
+        uint8_t classmap[256] = {};
+        uint32_t nclasses = 1;
+        for (const auto &state : nfa.states)
+        {
+            if (state.next < 0) continue;
+            std::map<std::pair<uint8_t, bool>, uint8_t> split;
+            for (size_t c = 0; c < 256; ++c)
+            {
+                auto [it, added] = split.emplace(std::make_pair(classmap[c], (bool)state.set[c]), (uint8_t)split.size());
+                classmap[c] = it->second;
+            }
+            nclasses = (uint32_t)split.size();
+        }
+        vector<uint8_t> representative(nclasses);
+        for (size_t c = 256; c-- > 0;)
+            representative[classmap[c]] = (uint8_t)c;
+
+        // subset construction, state 0 is the empty (dead) set
+        std::map<vector<int>, uint32_t> ids;
+        vector<vector<int>> sets = {{}};
+        ids[{}] = 0;
+        vector<int> first = {start};
+        nfa.closure(first);
+        ids[first] = 1;
+        sets.push_back(first);
+        vector<uint32_t> next;
+        for (size_t d = 0; d < sets.size(); ++d)
+        {
+            for (uint32_t c = 0; c < nclasses; ++c)
+            {
+                vector<int> move;
+                for (int s : sets[d])
+                    if (nfa.states[s].next >= 0 && nfa.states[s].set[representative[c]])
+                        move.push_back(nfa.states[s].next);
+                nfa.closure(move);
+                auto [it, added] = ids.emplace(move, (uint32_t)sets.size());
+                if (added) sets.push_back(move);
+                next.push_back(it->second);
+            }
+        }
+        vector<int32_t> accept(sets.size(), -1);
+        for (size_t d = 0; d < sets.size(); ++d)
+            for (int s : sets[d])
+                if (nfa.states[s].accept >= 0 && (accept[d] < 0 || nfa.states[s].accept < accept[d]))
+                    accept[d] = nfa.states[s].accept;
+
+        // Moore minimisation, start by splitting on the accepted rule then refine on transitions
+        vector<uint32_t> block(sets.size());
+        size_t nblocks = 0;
+        {
+            std::map<int32_t, uint32_t> initial;
+            for (size_t d = 0; d < sets.size(); ++d)
+                block[d] = initial.emplace(accept[d], (uint32_t)initial.size()).first->second;
+            nblocks = initial.size();
+        }
+        for (;;)
+        {
+            std::map<vector<uint32_t>, uint32_t> signatures;
+            vector<uint32_t> refined(sets.size());
+            for (size_t d = 0; d < sets.size(); ++d)
+            {
+                vector<uint32_t> sig = {block[d]};
+                for (uint32_t c = 0; c < nclasses; ++c)
+                    sig.push_back(block[next[d * nclasses + c]]);
+                refined[d] = signatures.emplace(sig, (uint32_t)signatures.size()).first->second;
+            }
+            block = std::move(refined);
+            if (signatures.size() == nblocks) break;
+            nblocks = signatures.size();
+        }
+
+        // renumber so the dead state's block is 0
+        vector<uint32_t> renumber(nblocks, UINT32_MAX);
+        uint32_t count = 0;
+        renumber[block[0]] = count++;
+        for (size_t d = 1; d < sets.size(); ++d)
+            if (renumber[block[d]] == UINT32_MAX)
+                renumber[block[d]] = count++;
+
+        std::memcpy(rtn.classmap, classmap, sizeof(classmap));
+        rtn.nclasses = nclasses;
+        rtn.start = renumber[block[1]];
+        rtn.next.assign(count * nclasses, 0);
+        rtn.accept.assign(count, -1);
+        for (size_t d = 0; d < sets.size(); ++d)
+        {
+            uint32_t b = renumber[block[d]];
+            rtn.accept[b] = b == 0 ? -1 : accept[d];
+            for (uint32_t c = 0; c < nclasses; ++c)
+                rtn.next[b * nclasses + c] = b == 0 ? 0 : renumber[block[next[d * nclasses + c]]];
+        }
+        rtn.rules.clear();
+        for (const auto &regex : regexes)
+            rtn.rules.push_back(regex.second);
+        return true;
+    }
+
+    // builds vocab.dfa from the main mode's vocabulary literals, vocab.rules and the WORD class
+    static inline bool build_dfa(vocabulary_t &vocab, string &error)
+    {
+        const mode_t &main = vocab.modes[0];
+        const vector<rule_t> &rules = vocab.rules;
+        // trie iteration order is unspecified, sort the literals to keep the table layout deterministic
+        std::map<string, dfa_rule_t> literals;
+        main.tokens.each([&](const string &str, const vector<entry_t> &values)
+        {
+            dfa_rule_t rule = {values[0].type, -1, values[0].id, {}};
+            if (auto &&it = main.delimiters.find(str); it != main.delimiters.end())
+                rule.delim = it->second;
+            literals[str] = rule;
+        });
+        vector<std::pair<regex_t, dfa_rule_t>> regexes;
+        for (const auto &[str, rule] : literals)
+            regexes.emplace_back(literal_regex(str), rule);
+
+        for (size_t i = 0; i < rules.size(); ++i)
+        {
+            regex_t regex;
+            if (!parse_regex(rules[i].regex, regex, error))
+            {
+                error = "rule " + rules[i].name + ": " + error;
+                return false;
+            }
+            regexes.emplace_back(std::move(regex), dfa_rule_t{token_type::USER, (int)i, -1, {}});
+        }
+
+        // identifiers, like identifier_start and scan_identifier
+        bitset<256> word;
+        bool unicode = true;
+        for (size_t c = 0; c < 256; ++c)
+        {
+            word[c] = main.classes[(char)c] == WORD;
+            unicode = unicode && (c < 0x80 || main.classes[(char)c] == UTF8);
+        }
+        if (word.any())
+        {
+            regex_t start(regex_t::ALT), cont(regex_t::ALT);
+            start.nodes.emplace_back(word);
+            cont.nodes.emplace_back(word);
+            if (unicode)
+            {
+                start.nodes.push_back(utf8_regex(xid_start, sizeof(xid_start) / sizeof(xid_start[0])));
+                cont.nodes.push_back(utf8_regex(xid_continue, sizeof(xid_continue) / sizeof(xid_continue[0])));
+            }
+            regex_t rest(regex_t::REPEAT);
+            rest.max = regex_t::unbounded;
+            rest.nodes.push_back(std::move(cont));
+            regex_t ident(regex_t::CAT);
+            ident.nodes.push_back(std::move(start));
+            ident.nodes.push_back(std::move(rest));
+            regexes.emplace_back(std::move(ident), dfa_rule_t{token_type::USER, -1, -1, {}});
+        }
+
+        return build_dfa(vocab.dfa, regexes);
+    }
+}
+
+#endif
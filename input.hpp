@@ -0,0 +1,404 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_INPUT_HPP
+#define LEX_INPUT_HPP
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "unicode.hpp"
+#include "counters.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define LEX_SSE2 1
+#endif
+#if defined(LEX_SSE2) && defined(__GNUC__)
+// the SSSE3 validator is compiled with a target attribute and picked at runtime
+#define LEX_SSSE3 1
+#endif
+
+namespace lex
+{
+    enum class encoding_t { AUTO, UTF8, UTF16LE, UTF16BE, LATIN1 };
+
+    static inline const char *encoding_name(encoding_t encoding)
+    {
+        switch (encoding)
+        {
+            case encoding_t::AUTO: return "auto";
+            case encoding_t::UTF8: return "utf8";
+            case encoding_t::UTF16LE: return "utf16le";
+            case encoding_t::UTF16BE: return "utf16be";
+            case encoding_t::LATIN1: return "latin1";
+            default: return "unknown";
+        }
+    }
+
+    // lexer input as UTF-8, text views the raw bytes when they were already valid UTF-8
+    // (less any BOM) and storage when they had to be transcoded
+    struct input_t
+    {
+        encoding_t encoding = encoding_t::AUTO;
+        std::string storage;
+        std::string_view text;
+        size_t error = std::string_view::npos; // offset into the raw bytes of the first invalid unit
+    };
+
+    // validates from pos, which must be at the start of a character, returns the offset of
+    // the first byte that doesn't start a valid character or npos
+    static inline size_t validate_utf8_scalar(std::string_view src, size_t pos)
+    {
+        while (pos < src.size())
+        {
+            // 8 bytes at a time while they're ASCII
+            uint64_t word;
+            while (pos + 8 <= src.size() && (std::memcpy(&word, src.data() + pos, 8), (word & 0x8080808080808080ULL) == 0))
+                pos += 8;
+            if (pos == src.size())
+                break;
+            if ((uint8_t)src[pos] < 0x80)
+            {
+                ++pos;
+                continue;
+            }
+            uint32_t cp;
+            const size_t length = decode_utf8(src, pos, cp);
+            if (length == 0)
+                return pos;
+            pos += length;
+        }
+        return std::string_view::npos;
+    }
+
+    // a character boundary at or before pos that no sequence crossing pos starts before,
+    // a sequence is at most 4 bytes so it's the start of the character holding pos - 3
+    static inline size_t utf8_resync(std::string_view src, size_t pos)
+    {
+        pos = pos < 3 ? 0 : pos - 3;
+        for (size_t i = 0; i < 3 && pos > 0 && ((uint8_t)src[pos] & 0xC0) == 0x80; ++i)
+            --pos;
+        return pos;
+    }
+
+#ifdef LEX_SSSE3
+    // 16 bytes at a time with the lookup table algorithm from Keiser and Lemire, "Validating
+    // UTF-8 In Less Than One Instruction Per Byte". blocks are only checked once all of
+    // their sequences are known, when a block has an error the scalar validator is rerun
+    // from the character before it to find the exact offset
+    __attribute__((target("ssse3")))
+    static inline size_t validate_utf8_ssse3(std::string_view src)
+    {
+        enum : uint8_t
+        {
+            TOO_SHORT = 1 << 0, TOO_LONG = 1 << 1, OVERLONG_3 = 1 << 2, TOO_LARGE = 1 << 3,
+            SURROGATE = 1 << 4, OVERLONG_2 = 1 << 5, TOO_LARGE_1000 = 1 << 6, OVERLONG_4 = 1 << 6,
+            TWO_CONTS = 1 << 7, CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+        };
+        const __m128i byte_1_high_table = _mm_setr_epi8(
+            TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+        const __m128i byte_1_low_table = _mm_setr_epi8(
+            CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+            CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000);
+        const __m128i byte_2_high_table = _mm_setr_epi8(
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+        const __m128i nibble = _mm_set1_epi8(0x0F);
+        const __m128i third_byte = _mm_set1_epi8((char)(0xE0 - 0x80));
+        const __m128i fourth_byte = _mm_set1_epi8((char)(0xF0 - 0x80));
+        const __m128i high_bit = _mm_set1_epi8((char)0x80);
+
+        __m128i prev = _mm_setzero_si128();
+        size_t pos = 0;
+        for (; pos + 16 <= src.size(); pos += 16)
+        {
+            const __m128i input = _mm_loadu_si128((const __m128i *)(src.data() + pos));
+            // an ASCII block after an ASCII block can't have an error or an unfinished sequence
+            if ((_mm_movemask_epi8(input) | _mm_movemask_epi8(prev)) == 0)
+                continue;
+
+            const __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+            const __m128i special = _mm_and_si128(_mm_and_si128(
+                _mm_shuffle_epi8(byte_1_high_table, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+                _mm_shuffle_epi8(byte_1_low_table, _mm_and_si128(prev1, nibble))),
+                _mm_shuffle_epi8(byte_2_high_table, _mm_and_si128(_mm_srli_epi16(input, 4), nibble)));
+            const __m128i must_be_2_3_continuation = _mm_or_si128(
+                _mm_subs_epu8(_mm_alignr_epi8(input, prev, 14), third_byte),
+                _mm_subs_epu8(_mm_alignr_epi8(input, prev, 13), fourth_byte));
+            const __m128i error = _mm_xor_si128(_mm_and_si128(must_be_2_3_continuation, high_bit), special);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF)
+                return validate_utf8_scalar(src, utf8_resync(src, pos));
+            prev = input;
+        }
+        // the tail and any sequence left unfinished by the last block
+        return validate_utf8_scalar(src, utf8_resync(src, pos));
+    }
+#endif
+
+    // offset of the first byte that doesn't start a valid UTF-8 character, or npos
+    static inline size_t validate_utf8(std::string_view src)
+    {
+#ifdef LEX_SSSE3
+        static const bool ssse3 = __builtin_cpu_supports("ssse3");
+        if (ssse3)
+            return validate_utf8_ssse3(src);
+#endif
+        return validate_utf8_scalar(src, 0);
+    }
+
+    static inline void latin1_to_utf8(std::string_view src, std::string &out)
+    {
+        out.resize(src.size() * 2);
+        char *it = &out[0];
+        size_t pos = 0;
+        while (pos < src.size())
+        {
+#ifdef LEX_SSE2
+            // ASCII blocks are copied straight through
+            while (pos + 16 <= src.size())
+            {
+                const __m128i input = _mm_loadu_si128((const __m128i *)(src.data() + pos));
+                if (_mm_movemask_epi8(input) != 0)
+                    break;
+                _mm_storeu_si128((__m128i *)it, input);
+                it += 16;
+                pos += 16;
+            }
+            for (const size_t end = std::min(pos + 16, src.size()); pos < end; ++pos)
+#else
+            for (; pos < src.size(); ++pos)
+#endif
+            {
+                const uint8_t c = (uint8_t)src[pos];
+                if (c < 0x80)
+                    *it++ = (char)c;
+                else
+                {
+                    *it++ = (char)(0xC0 | (c >> 6));
+                    *it++ = (char)(0x80 | (c & 0x3F));
+                }
+            }
+        }
+        out.resize(it - out.data());
+    }
+
+    // returns the byte offset into src of the first unpaired surrogate or odd trailing byte, or npos
+    static inline size_t utf16_to_utf8(std::string_view src, bool big_endian, std::string &out)
+    {
+        // every unit becomes at most 3 bytes, surrogate pairs 4 bytes for 2 units
+        out.resize(src.size() / 2 * 3);
+        char *it = &out[0];
+        const size_t units = src.size() / 2;
+        auto unit = [&](size_t i) -> uint16_t
+        {
+            const uint8_t lo = (uint8_t)src[i * 2 + (big_endian ? 1 : 0)];
+            const uint8_t hi = (uint8_t)src[i * 2 + (big_endian ? 0 : 1)];
+            return (uint16_t)(lo | (hi << 8));
+        };
+
+        size_t i = 0;
+        while (i < units)
+        {
+#ifdef LEX_SSE2
+            // 8 units at a time while they're all ASCII
+            const __m128i ascii_mask = _mm_set1_epi16((short)0xFF80);
+            while (i + 8 <= units)
+            {
+                __m128i input = _mm_loadu_si128((const __m128i *)(src.data() + i * 2));
+                if (big_endian)
+                    input = _mm_or_si128(_mm_slli_epi16(input, 8), _mm_srli_epi16(input, 8));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(input, ascii_mask), _mm_setzero_si128())) != 0xFFFF)
+                    break;
+                _mm_storel_epi64((__m128i *)it, _mm_packus_epi16(input, input));
+                it += 8;
+                i += 8;
+            }
+            for (const size_t end = std::min(i + 8, units); i < end;)
+#else
+            while (i < units)
+#endif
+            {
+                uint32_t cp = unit(i);
+                if (cp >= 0xD800 && cp <= 0xDBFF)
+                {
+                    if (i + 1 == units || unit(i + 1) < 0xDC00 || unit(i + 1) > 0xDFFF)
+                        return i * 2;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (unit(i + 1) - 0xDC00);
+                    ++i;
+                }
+                else if (cp >= 0xDC00 && cp <= 0xDFFF)
+                    return i * 2;
+                it += encode_utf8(cp, it);
+                ++i;
+            }
+        }
+        out.resize(it - out.data());
+        return src.size() % 2 == 0 ? std::string_view::npos : src.size() - 1;
+    }
+
+    // decodes raw into input.text, AUTO picks the encoding from the BOM and otherwise expects
+    // UTF-8, latin1 has to be asked for. a BOM for the encoding is skipped whether or not it was
+    // asked for. raw has to outlive input when it was already UTF-8
+    static inline bool decode_input(std::string_view raw, input_t &input, encoding_t encoding = encoding_t::AUTO)
+    {
+        size_t bom = 0;
+        if (encoding == encoding_t::AUTO)
+        {
+            encoding = encoding_t::UTF8;
+            if (raw.substr(0, 2) == "\xFF\xFE") encoding = encoding_t::UTF16LE;
+            else if (raw.substr(0, 2) == "\xFE\xFF") encoding = encoding_t::UTF16BE;
+        }
+        if (encoding == encoding_t::UTF8 && raw.substr(0, 3) == "\xEF\xBB\xBF") bom = 3;
+        else if (encoding == encoding_t::UTF16LE && raw.substr(0, 2) == "\xFF\xFE") bom = 2;
+        else if (encoding == encoding_t::UTF16BE && raw.substr(0, 2) == "\xFE\xFF") bom = 2;
+        input.encoding = encoding;
+        input.storage.clear();
+        if (encoding != encoding_t::UTF8 && input.storage.capacity() < raw.size()) count(COUNT_ALLOCATIONS);
+        input.text = {};
+        input.error = std::string_view::npos;
+
+        switch (encoding)
+        {
+            case encoding_t::UTF16LE:
+            case encoding_t::UTF16BE:
+                if (size_t error = utf16_to_utf8(raw.substr(bom), encoding == encoding_t::UTF16BE, input.storage);
+                    error != std::string_view::npos)
+                {
+                    input.error = bom + error;
+                    return false;
+                }
+                input.text = input.storage;
+                return true;
+            case encoding_t::LATIN1:
+                latin1_to_utf8(raw, input.storage);
+                input.text = input.storage;
+                return true;
+            default:
+                if (size_t error = validate_utf8(raw.substr(bom)); error != std::string_view::npos)
+                {
+                    input.error = bom + error;
+                    return false;
+                }
+                input.text = raw.substr(bom);
+                return true;
+        }
+    }
+
+    // reads everything left on fd into str, for pipes and anything else without a size up front.
+    // blocks are read straight into str and it grows by doubling, so a pipe is read about as
+    // quickly as a file
+    static inline bool read_fd(int fd, std::string &str)
+    {
+        size_t size = 0;
+        if (str.capacity() < (1 << 20)) count(COUNT_ALLOCATIONS);
+        str.resize(1 << 20);
+#ifdef F_SETPIPE_SZ
+        // a bigger pipe means fewer wake ups, this fails harmlessly on anything that isn't one
+        fcntl(fd, F_SETPIPE_SZ, 1 << 20);
+#endif
+        for (;;)
+        {
+            if (str.size() - size < (1 << 16))
+            {
+                str.resize(str.size() * 2);
+                count(COUNT_ALLOCATIONS);
+            }
+#ifdef _WIN32
+            const int n = _read(fd, &str[size], (unsigned)std::min<size_t>(str.size() - size, 1 << 30));
+#else
+            const ssize_t n = ::read(fd, &str[size], str.size() - size);
+#endif
+            count(COUNT_READS);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0)
+            {
+                str.clear();
+                return false;
+            }
+            if (n == 0) break;
+            count(COUNT_READ_BYTES, n);
+            size += n;
+        }
+        str.resize(size);
+        return true;
+    }
+
+    // reads the whole file straight into str, "-" is stdin
+    static inline bool read_file(const std::string &path, std::string &str)
+    {
+        if (path == "-")
+            return read_fd(0, str);
+#ifndef _WIN32
+        // pipes and devices can't be sized with a seek, named pipes and /dev/fd/n included.
+        // a directory opens as a stream that seems to go on forever, so it's refused here
+        if (struct stat st; ::stat(path.c_str(), &st) == 0 && !S_ISREG(st.st_mode))
+        {
+            if (S_ISDIR(st.st_mode)) return false;
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            const bool rtn = read_fd(fd, str);
+            ::close(fd);
+            return rtn;
+        }
+#endif
+        std::ifstream strm(path, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+        if (!strm.is_open())
+            return false;
+        const size_t size = (size_t)strm.tellg();
+        if (str.capacity() < size) count(COUNT_ALLOCATIONS);
+        str.resize(size);
+        strm.seekg(0);
+        count(COUNT_READS);
+        count(COUNT_READ_BYTES, str.size());
+        return (bool)strm.read(&str[0], str.size()) || str.empty();
+    }
+}
+
+#endif
@@ -22,257 +22,586 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
-#include <string>
-#include <cstring>
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <unordered_map>
-#include <locale>
-#include <memory>
-
-namespace lak
+#include "lex.hpp"
+#include "dfa.hpp"
+#include "spec.hpp"
+#include "input.hpp"
+#include "writer.hpp"
+#include "binary.hpp"
+#include "token_cache.hpp"
+#include "stats.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using std::ifstream;
+using std::cout;
+using std::cerr;
+using std::cin;
+using std::vector;
+using std::string;
+using namespace std::string_literals;
+namespace fs = std::filesystem;
+
+// how tokens are written out
+struct options_t
 {
-    using std::string;
-    using std::vector;
-    using std::unordered_map;
-    using std::shared_ptr;
-    using std::make_shared;
-    using std::ostream;
-
-    template<typename T>
-    struct suffix_trie_t
+    string format = "text";
+    bool with_text = true; // ndjson
+    size_t batch = 0;      // ndjson tokens per line, 0 for one object per token
+};
+
+// NDJSON lines of one token each, or of batch tokens wrapped in {"tokens":[...]}
+struct ndjson_lines_t
+{
+    lex::writer_t &out;
+    size_t batch;
+    size_t count = 0;
+
+    void before()
+    {
+        if (batch > 0)
+            out.write(count == 0 ? "{\"tokens\":[" : ",", count == 0 ? 11 : 1);
+    }
+
+    void after()
     {
-        string key;
-        vector<T> values;
-        unordered_map<char, shared_ptr<suffix_trie_t<T>>> children;
-
-        suffix_trie_t() {}
-        suffix_trie_t(const vector<T> &val) : values(val) {}
-        suffix_trie_t(vector<T> &&val) : values(val) {}
-        suffix_trie_t(const string str) : key(str) {}
-        suffix_trie_t(const string str, const vector<T> &val) : key(str), values(val) {}
-        suffix_trie_t(const string str, vector<T> &&val) : key(str), values(val) {}
-
-        inline shared_ptr<suffix_trie_t<T>> find_partial(const char c) const
+        if (batch == 0 || ++count == batch)
         {
-            if (auto &&it = children.find(c); it != children.end())
-                return it->second;
-            return nullptr;
+            if (batch > 0) out.write("]}", 2);
+            out.put('\n');
+            count = 0;
         }
+    }
+
+    void finish()
+    {
+        if (count > 0)
+            out.write("]}\n", 3);
+        count = 0;
+    }
+};
 
-        inline shared_ptr<suffix_trie_t<T>> operator[](const char c) const
+// the tokens of a binary section in any of the output formats, returns how many there were
+static uint64_t write_section(lex::writer_t &out, const lex::binary_file_t &section, const options_t &options, std::string_view name)
+{
+    if (options.format == "binary")
+    {
+        section.write(out, name);
+        return section.header.token_count;
+    }
+    ndjson_lines_t lines = {out, options.batch};
+    lex::binary_token_t t;
+    for (auto cursor = section.tokens(); cursor.next(t);)
+    {
+        const bool named = t.rule >= 0 && (size_t)t.rule < section.rules.size();
+        const std::string_view kind = named ? section.rules[t.rule] : lex::type_name(t.type);
+        if (options.format == "ndjson")
         {
-            return find_partial(c);
+            lines.before();
+            lex::write_json_token(out, kind, t.offset, t.value, t.id, options.with_text);
+            lines.after();
         }
+        else
+            lex::write_token(out, kind, t.value);
+    }
+    lines.finish();
+    return section.header.token_count;
+}
 
-        inline shared_ptr<suffix_trie_t<T>> find_exact(const string str) const
+// prints a binary token stream, checking every section
+static int read_binary(const string &path, const options_t &options)
+{
+    lak::mapped_file_t file;
+    if (!file.open(path))
+    {
+        cerr << "failed to open " << path << '\n';
+        return 1;
+    }
+    lex::writer_t out(1);
+    lex::binary_reader_t reader(file.view());
+    lex::binary_file_t section;
+    string error;
+    while (reader.next(section, error))
+    {
+        if (!section.verify())
         {
-            if (auto &&it = children.find(str[0]); it != children.end() && it->second->key == str)
-                return it->second;
-            return nullptr;
+            cerr << path << ": checksum mismatch or bad token record in " << section.name << '\n';
+            return 1;
         }
+        write_section(out, section, options, section.name);
+    }
+    if (!error.empty())
+    {
+        cerr << path << ": " << error << '\n';
+        return 1;
+    }
+    return out.flush() ? 0 : 1;
+}
+
+// everything about how files are lexed and written, shared read only by the workers
+struct job_t
+{
+    std::shared_ptr<const lex::vocabulary_t> vocab;
+    string engine = "trie";
+    lex::encoding_t encoding = lex::encoding_t::AUTO;
+    options_t options;
+    std::unique_ptr<lex::token_cache_t> cache;
+    bool frame = false; // a header before each file's tokens
+};
+
+struct file_result_t
+{
+    uint64_t bytes = 0;
+    uint64_t tokens = 0;
+    string error; // set if the file couldn't be lexed, nothing it wrote should be used
+    bool unreadable = false;
+};
+
+// reads, decodes and lexes the file at path into out, or only counts its tokens into stats
+static void lex_file(lex::writer_t &out, const job_t &job, const string &path, file_result_t &result, lex::token_stats_t *stats)
+{
+    string raw;
+    if (!lex::read_file(path, raw))
+    {
+        result.error = "failed to read " + path;
+        result.unreadable = true;
+        return;
+    }
+    result.bytes = raw.size();
 
-        inline shared_ptr<suffix_trie_t<T>> operator[](const string str) const
+    // UTF-8 input is lexed in place, anything else is transcoded once
+    lex::input_t input;
+    if (!lex::decode_input(raw, input, job.encoding))
+    {
+        result.error = path + ": invalid " + lex::encoding_name(input.encoding) + " at byte " + std::to_string(input.error);
+        return;
+    }
+
+    if (stats != nullptr)
+    {
+        ++stats->files;
+        stats->bytes += raw.size();
+    }
+
+    const options_t &options = job.options;
+    if (job.frame && stats == nullptr)
+    {
+        if (options.format == "text")
+        {
+            out.write("==> ", 4);
+            out.write(path);
+            out.write(" <==\n", 5);
+        }
+        else if (options.format == "ndjson")
         {
-            return find_exact(str);
+            string line(path.size() * 6 + 16, '\0');
+            char *it = lex::json_literal(&line[0], "{\"file\":");
+            it = lex::json_bytes(it, path);
+            *it++ = '}';
+            *it++ = '\n';
+            out.write(line.data(), it - line.data());
         }
+        // binary sections carry their own name
+    }
 
-        inline bool isTerminal() { return !children.size(); }
+    const lex::vocabulary_t &vocab = *job.vocab;
+    if (job.engine == "stream")
+    {
+        std::istringstream strm(string(input.text));
+        for (lex::token_t t = lex::next_token(strm, vocab.modes[0]); t.type != lex::token_type::END; t = lex::next_token(strm, vocab.modes[0]), ++result.tokens)
+        {
+            if (stats != nullptr) stats->add(t.type, -1, t.id, t.value);
+            else lex::write_token(out, vocab, t.type, -1, t.value);
+        }
+        return;
+    }
 
-        void set(const string str, vector<T> &&val) { set(str, val); }
-        void set(const string str, const vector<T> &val)
+    auto next = job.engine == "dfa" ? &lex::lexer_t::next_dfa : &lex::lexer_t::next;
+    if (job.cache)
+    {
+        // a hit skips lexing entirely, a miss is lexed once into the cache and served from there
+        lak::mapped_file_t file;
+        lex::binary_file_t section;
+        bool cached = job.cache->find(input.text, file, section);
+        if (!cached)
         {
-            if (auto &&it = find_partial(str[0]); it != nullptr)
-            {
-                string &k = it->key;
-                if (str.size() >= k.size() && !std::strncmp(str.c_str(), k.c_str(), k.size()))
-                {
-                    if (str.size() == k.size())
-                    {
-                        // they are the same
-                        it->values = val;
-                    }
-                    else
-                    {
-                        // k is the suffix of str
-                        it->set(str.substr(k.size()), val);
-                    }
-                }
-                else
-                {
-                    // key slot is taken, but this str doesn't match current slot key.
-                    // must split slot into largest common substring
-                    size_t same = 1; // start at 1 because we know the first character is the same
-                    for (; same < str.size() && same < k.size() && str[same] == k[same]; ++same);
-
-                    string &&commonstr = str.substr(0, same); // part of the string that's the same
-                    string &&oldstr = k.substr(same);         // rest of the old key string
-                    shared_ptr<suffix_trie_t<T>> replacement;
-
-                    if (same == str.size())
-                    {
-                        // str was the suffix of k
-                        // therefore the replacement node is also the node to set
-                        replacement = make_shared<suffix_trie_t<T>>(commonstr, val);
-                    }
-                    else
-                    {
-                        // str and k have different endings
-                        // therefore we must add the new node and the replacement node seperately
-                        replacement = make_shared<suffix_trie_t<T>>(commonstr);
-                        string &&setstr = str.substr(same);   // rest of the set key string
-                        replacement->children[setstr[0]] = make_shared<suffix_trie_t<T>>(setstr, val);
-                    }
-
-                    it->key = oldstr;
-                    replacement->children[oldstr[0]] = it;
-
-                    children[commonstr[0]] = replacement;
-                }
-            }
-            else
+            lex::lexer_t lexer(job.vocab, input.text);
+            lex::binary_encoder_t encoder;
+            encoder.reset(path, input.text, vocab);
+            for (lex::token_view_t t = (lexer.*next)(); t.type != lex::token_type::END; t = (lexer.*next)())
+                encoder.add(t);
+            cached = job.cache->store(encoder, file, section);
+            if (!cached && options.format == "binary" && stats == nullptr)
             {
-                children[str[0]] = make_shared<suffix_trie_t<T>>(str, val);
+                if (encoder.finish(out, result.error))
+                    result.tokens = encoder.count;
+                return;
             }
         }
+        // if the cache couldn't be written the file is lexed again below
+        if (cached && stats != nullptr)
+        {
+            // the section's rules and ids size the counters, so any the vocabulary doesn't have
+            // are dropped like write_section drops rule names it can't find
+            lex::binary_token_t t;
+            for (auto cursor = section.tokens(); cursor.next(t); ++result.tokens)
+                stats->add(t.type, (size_t)t.rule < vocab.rules.size() ? t.rule : -1,
+                    (size_t)t.id < vocab.entries.size() ? t.id : -1, t.value);
+            return;
+        }
+        if (cached)
+        {
+            result.tokens = write_section(out, section, options, path);
+            return;
+        }
+    }
 
-        friend ostream &operator<<(ostream &strm, const suffix_trie_t &rhs)
+    lex::lexer_t lexer(job.vocab, input.text);
+    if (stats != nullptr)
+    {
+        for (lex::token_view_t t = (lexer.*next)(); t.type != lex::token_type::END; t = (lexer.*next)(), ++result.tokens)
+            stats->add(t);
+        return;
+    }
+    if (options.format == "binary")
+    {
+        lex::binary_encoder_t encoder;
+        encoder.reset(path, input.text, vocab);
+        for (lex::token_view_t t = (lexer.*next)(); t.type != lex::token_type::END; t = (lexer.*next)())
+            encoder.add(t);
+        if (encoder.finish(out, result.error))
+            result.tokens = encoder.count;
+        return;
+    }
+    if (options.format == "ndjson")
+    {
+        ndjson_lines_t lines = {out, options.batch};
+        for (lex::token_view_t t = (lexer.*next)(); t.type != lex::token_type::END; t = (lexer.*next)(), ++result.tokens)
         {
-            static size_t offset = 0;
-            string space = "";
-            for (size_t i = 0; i < offset; ++i)
-                space += ' ';
-
-            offset += 2;
-            for (const auto &[childk, childv] : rhs.children)
-                strm << '\n' << space << "child "  << childv->key << " " << *childv;
-            offset -= 2;
-            return strm;
+            lines.before();
+            lex::write_json_token(out, vocab, t, input.text.data(), options.with_text);
+            lines.after();
         }
-    };
+        lines.finish();
+        return;
+    }
+    for (lex::token_view_t t = (lexer.*next)(); t.type != lex::token_type::END; t = (lexer.*next)(), ++result.tokens)
+        lex::write_token(out, vocab, t);
 }
 
+// the counts in stats, largest first, with the top most common entries and identifiers
+static void print_stats(const lex::token_stats_t &stats, const lex::vocabulary_t &vocab, size_t top)
+{
+    vector<std::pair<uint64_t, std::string_view>> rows;
+    auto print = [&](const char *title, size_t limit)
+    {
+        std::sort(rows.begin(), rows.end(), [](const auto &a, const auto &b) { return a.first != b.first ? a.first > b.first : a.second < b.second; });
+        cout << title << '\n';
+        char count[32];
+        for (size_t i = 0; i < rows.size() && i < limit; ++i)
+        {
+            std::snprintf(count, sizeof(count), "%12llu  ", (unsigned long long)rows[i].first);
+            cout << count << rows[i].second << '\n';
+        }
+        rows.clear();
+    };
 
+    cout << "files " << stats.files << "\nbytes " << stats.bytes << "\ntokens " << stats.tokens << '\n';
+    for (size_t i = 1; i < 6; ++i)
+        if (stats.types[i] > 0) rows.emplace_back(stats.types[i], lex::type_name((lex::token_type)i));
+    for (size_t i = 0; i < std::min(stats.rules.size(), vocab.rules.size()); ++i)
+        if (stats.rules[i] > 0) rows.emplace_back(stats.rules[i], vocab.rules[i].name);
+    print("kinds", (size_t)-1);
+    for (size_t i = 0; i < std::min(stats.entries.size(), vocab.entries.size()); ++i)
+        if (stats.entries[i] > 0) rows.emplace_back(stats.entries[i], vocab.entries[i]);
+    print("entries", top);
+    for (const auto &[value, count] : stats.identifiers)
+        rows.emplace_back(count, value);
+    print("identifiers", top);
+}
 
-
-namespace lex
+// path itself, or every regular file under it with one of extensions if it's a directory
+static void add_path(const string &path, const vector<string> &extensions, vector<string> &files)
 {
-    using std::string;
-    using std::istream;
-    using std::vector;
-    using std::unordered_map;
-    using std::isspace;
-
-    static std::locale loc = std::locale("C");
-    enum token_type { END, USER, KEYWORD, SYMBOL };
-    static lak::suffix_trie_t<token_type> tokens;
-    struct token_t { token_type type; string value; };
-
-    static inline bool is_letter(char c)
+    std::error_code ec;
+    if (!fs::is_directory(path, ec))
     {
-        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        files.push_back(path);
+        return;
     }
-
-    static inline bool is_number(char c)
+    vector<string> found;
+    for (fs::recursive_directory_iterator it(path, fs::directory_options::skip_permission_denied, ec), end; !ec && it != end; it.increment(ec))
     {
-        return c >= '0' && c <= '9';
+        if (!it->is_regular_file(ec)) continue;
+        const string extension = it->path().extension().string();
+        if (extensions.empty() || std::find(extensions.begin(), extensions.end(), extension) != extensions.end())
+            found.push_back(it->path().string());
     }
+    // directory order isn't stable, sort so output is the same every run
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+}
 
-    static inline bool is_alphanumeric(char c)
+// lexes files on jobs threads, each into a buffer of its own, and writes the buffers to stdout
+// in the order the files were given. at most a few files per thread are held at once. with
+// stats nothing is written and each thread counts into stats[thread] instead
+static int lex_corpus(const job_t &job, const vector<string> &files, size_t jobs, vector<lex::token_stats_t> *stats)
+{
+    struct slot_t { string output; file_result_t result; bool done = false; };
+    vector<slot_t> slots(files.size());
+    std::mutex mutex;
+    std::condition_variable ready, room;
+    size_t next = 0, written = 0;
+    const size_t window = jobs * 4;
+
+    auto work = [&](size_t thread)
     {
-        return is_letter(c) || is_number(c);
-    }
+        for (;;)
+        {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                room.wait(lock, [&] { return next >= files.size() || next < written + window; });
+                if (next >= files.size()) return;
+                i = next++;
+            }
+            slot_t &slot = slots[i];
+            {
+                lex::writer_t out(slot.output);
+                lex_file(out, job, files[i], slot.result, stats != nullptr ? &(*stats)[thread] : nullptr);
+                out.flush();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.done = true;
+            }
+            ready.notify_all();
+        }
+    };
 
-    static inline bool is_symbol(char c)
+    const auto start = std::chrono::steady_clock::now();
+    vector<std::thread> pool;
+    for (size_t i = 0; i < jobs; ++i)
+        pool.emplace_back(work, i);
+
+    lex::writer_t out(1);
+    uint64_t bytes = 0, tokens = 0;
+    size_t errors = 0;
+    while (written < files.size())
     {
-        return !(is_letter(c) || is_number(c) || isspace(c, loc));
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&] { return slots[written].done; });
+        }
+        slot_t &slot = slots[written];
+        if (slot.result.error.empty())
+            out.write(slot.output);
+        else
+        {
+            out.flush();
+            cerr << slot.result.error << '\n';
+            ++errors;
+        }
+        bytes += slot.result.bytes;
+        tokens += slot.result.tokens;
+        string().swap(slot.output);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++written;
+        }
+        room.notify_all();
     }
+    for (std::thread &thread : pool)
+        thread.join();
+    const bool flushed = out.flush();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    char summary[256];
+    std::snprintf(summary, sizeof(summary), "%zu files, %llu bytes, %llu tokens, %zu errors in %.3fs (%.1f MB/s)\n",
+        files.size() - errors, (unsigned long long)bytes, (unsigned long long)tokens, errors,
+        elapsed.count(), bytes / std::max(elapsed.count(), 1e-9) / 1e6);
+    cerr << summary;
+    return errors == 0 && flushed ? 0 : 1;
+}
 
-    static inline bool hit_word_boundry(char c1, char c2)
+int main(int argc, char **argv)
+{
+    string spec;
+    bool use_cache = true;
+    bool dump = false;
+    job_t job;
+    string read_path;
+    bool token_cache = false;
+    uint64_t token_cache_mb = 1024;
+    vector<string> paths;
+    vector<string> extensions;
+    bool files0 = false;
+    bool stats = false;
+    bool counters = false;
+    size_t top = 20;
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 1; i < argc; ++i)
     {
-        if (c1 == 0) return false;
-        if (isspace(c2, loc)) return true;
-        if (is_alphanumeric(c1) != is_alphanumeric(c2)) return true;
-        return false;
+        if (argv[i] == "--spec"s && i + 1 < argc) spec = argv[++i];
+        else if (argv[i] == "--no-cache"s) use_cache = false;
+        else if (argv[i] == "--dump"s) dump = true;
+        else if (argv[i] == "--engine"s && i + 1 < argc && (argv[i+1] == "trie"s || argv[i+1] == "dfa"s || argv[i+1] == "stream"s))
+            job.engine = argv[++i];
+        else if (argv[i] == "--format"s && i + 1 < argc && (argv[i+1] == "text"s || argv[i+1] == "binary"s || argv[i+1] == "ndjson"s))
+            job.options.format = argv[++i];
+        else if (argv[i] == "--no-text"s) job.options.with_text = false;
+        else if (argv[i] == "--batch"s && i + 1 < argc) job.options.batch = std::strtoul(argv[++i], nullptr, 10);
+        else if (argv[i] == "--read"s && i + 1 < argc) read_path = argv[++i];
+        else if (argv[i] == "--token-cache"s) token_cache = true;
+        else if (argv[i] == "--token-cache-size"s && i + 1 < argc) token_cache_mb = std::strtoull(argv[++i], nullptr, 10);
+        else if (argv[i] == "--files0"s) files0 = true;
+        else if (argv[i] == "--stats"s) stats = true;
+        else if (argv[i] == "--counters"s) counters = true;
+        else if (argv[i] == "--top"s && i + 1 < argc) top = std::strtoul(argv[++i], nullptr, 10);
+        else if (argv[i] == "--jobs"s && i + 1 < argc) jobs = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+        else if (argv[i] == "--ext"s && i + 1 < argc)
+        {
+            // comma separated, with or without the dot
+            std::istringstream list(argv[++i]);
+            for (string extension; std::getline(list, extension, ',');)
+                if (!extension.empty())
+                    extensions.push_back(extension[0] == '.' ? extension : "." + extension);
+        }
+        else if (argv[i] == "--encoding"s && i + 1 < argc)
+        {
+            const string name = argv[++i];
+            if (name == "auto") job.encoding = lex::encoding_t::AUTO;
+            else if (name == "utf8") job.encoding = lex::encoding_t::UTF8;
+            else if (name == "utf16le") job.encoding = lex::encoding_t::UTF16LE;
+            else if (name == "utf16be") job.encoding = lex::encoding_t::UTF16BE;
+            else if (name == "latin1") job.encoding = lex::encoding_t::LATIN1;
+            else
+            {
+                cerr << "unknown encoding " << name << '\n';
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-' || argv[i] == "-"s)
+            paths.push_back(argv[i]);
+        else
+        {
+            cerr << "usage: " << argv[0] << " [options] [file|directory...]\n"
+                "    [--spec file] [--no-cache] [--dump] [--engine trie|dfa|stream]\n"
+                "    [--encoding auto|utf8|utf16le|utf16be|latin1] [--format text|binary|ndjson]\n"
+                "    [--no-text] [--batch tokens] [--token-cache] [--token-cache-size MB]\n"
+                "    [--files0] [--ext c,h,...] [--jobs n] [--stats] [--top n] [--counters]\n"
+                "       " << argv[0] << " --read tokens.lext [--format text|binary|ndjson]\n"
+                "with no files the name of one is read from stdin, --files0 reads a NUL separated list and - is stdin itself\n";
+            return 1;
+        }
     }
 
-    static token_t next_token(istream &strm)
+    // printed on the way out of main, after every writer has flushed
+    struct counters_report_t
     {
-        string str = "";
-        token_t rtn = { END, "" };
-        while (strm.good() && isspace((char)strm.peek(), loc)) strm.get(); // skip whitespace
-        for (char p = 0, c = strm.get(); strm.good(); c = strm.get())
+        bool enabled;
+        ~counters_report_t()
         {
-            auto &&it = tokens.find_exact(str);
-            if (hit_word_boundry(p, c) || (it != nullptr && it->values.size() > 0 && it->values[0] == token_type::SYMBOL &&
-                (it->isTerminal() || (tokens.find_exact(str+(char)strm.peek()) == nullptr)) // terminal or next c makes it invalid
-            ))
+            if (!enabled) return;
+            if (!lex::counters_enabled)
             {
-                // reached the end of the token
-                if (it != nullptr && it->values.size() > 0)
-                {
-                    // we found a token!
-                    rtn.type = it->values[0];
-                    rtn.value = str;
-                    break;
-                }
-                else
-                {
-                    // it wasn't a valid token
-                    rtn.type = token_type::USER;
-                    rtn.value = str;
-                    break;
-                }
+                cerr << "counters are compiled out, rebuild with make COUNTERS=1\n";
+                return;
             }
-            str += c;
-            p = c;
+            const lex::counters_t snapshot = lex::counters_snapshot();
+            for (size_t i = 0; i < lex::COUNTER_COUNT; ++i)
+                cerr << lex::counter_names[i] << ' ' << snapshot.values[i] << '\n';
         }
-        if (strm.good())
-            strm.unget();
-        return rtn;
+    } report = {counters};
+
+    if (!read_path.empty())
+        return read_binary(read_path, job.options);
+
+    if (job.engine == "stream" && job.options.format != "text")
+    {
+        cerr << job.options.format << " output needs the trie or dfa engine\n";
+        return 1;
     }
-}
 
-using std::ifstream;
-using std::cout;
-using std::cin;
-using std::vector;
-using std::string;
-using namespace std::string_literals;
+    auto vocab = std::make_shared<lex::vocabulary_t>();
+    if (spec.empty())
+    {
+        lex::load_builtin(*vocab);
+        if (string error; job.engine == "dfa" && !lex::build_dfa(*vocab, error))
+        {
+            cerr << error << '\n';
+            return 1;
+        }
+    }
+    else if (string error; !lex::load_spec(spec, use_cache, *vocab, error))
+    {
+        cerr << error << '\n';
+        return 1;
+    }
+    job.vocab = vocab;
 
-int main()
-{
-    vector<string> symbols = {
-        "~","~=","`","!","!=","@","#","$","%","%=","^","^=","&","&=","&&","*","*=","-","-=","+","+=","=",
-        "(",")","[","}","[","]","|","|=","||",":",";","<","<=",">",">=","==",",",".","?","/","'","->","\"","\\"
-    };
-    for (const string &str : symbols)
-        lex::tokens.set(str, {lex::token_type::SYMBOL});
-    vector<string> keywords = {
-        "for", "while", "if", "switch", "case", "default", "break", "const", "constexpr", "return",
-        "friend", "public", "private", "protected", "struct", "enum", "union", "class"
-    };
-    for (const string &str : keywords)
-        lex::tokens.set(str, {lex::token_type::KEYWORD});
+    if (dump)
+    {
+        for (const lex::mode_t &mode : vocab->modes)
+            cout << (vocab->modes.size() > 1 ? "mode " + mode.name : "") << mode.tokens << '\n';
+    }
 
-    cout << lex::tokens;
+    if (fs::path dir = lex::cache_dir(); token_cache && !dir.empty() && job.engine != "stream")
+        job.cache = std::make_unique<lex::token_cache_t>(dir / "tokens", token_cache_mb << 20, *vocab, job.engine);
 
-    string filename;
-    std::getline(cin, filename);
-    if (ifstream strm(filename, ifstream::in | ifstream::binary); strm.is_open())
+    // tokens go straight to stdout through our own buffer
+    cout.flush();
+
+    // the original interface, one file name on stdin, or a lone - to lex stdin itself as a filter
+    if ((paths.empty() || (paths.size() == 1 && paths[0] == "-")) && !files0)
     {
-        for (lex::token_t t = lex::next_token(strm); t.type != lex::token_type::END; t = lex::next_token(strm))
+        string filename = "-";
+        if (paths.empty())
+            std::getline(cin, filename);
+        lex::writer_t out(1);
+        file_result_t result;
+        lex::token_stats_t counts(*vocab);
+        lex_file(out, job, filename, result, stats ? &counts : nullptr);
+        // a file name that can't be read stays silent like it always has, stdin itself is an error
+        if (result.unreadable && paths.empty())
+            return 0;
+        if (!result.error.empty())
         {
-            switch(t.type)
-            {
-                case lex::token_type::END: { cout << "END: "; } break;
-                case lex::token_type::USER: { cout << "USER: "; } break;
-                case lex::token_type::KEYWORD: { cout << "KEYWORD: "; } break;
-                case lex::token_type::SYMBOL: { cout << "SYMBOL: "; } break;
-            }
-            cout << t.value << '\n';
+            out.used = 0;
+            cerr << result.error << '\n';
+            return 1;
         }
+        if (stats)
+            print_stats(counts, *vocab, top);
+        return out.flush() ? 0 : 1;
+    }
+
+    if (files0)
+    {
+        std::ostringstream list;
+        list << cin.rdbuf();
+        std::istringstream names(list.str());
+        for (string name; std::getline(names, name, '\0');)
+            if (!name.empty())
+                paths.push_back(name);
+    }
+    vector<string> files;
+    for (const string &path : paths)
+        add_path(path, extensions, files);
+    job.frame = true;
+    jobs = std::min(jobs, std::max<size_t>(files.size(), 1));
+    vector<lex::token_stats_t> counts;
+    for (size_t i = 0; stats && i < jobs; ++i)
+        counts.emplace_back(*vocab);
+    const int rtn = lex_corpus(job, files, jobs, stats ? &counts : nullptr);
+    if (stats)
+    {
+        for (size_t i = 1; i < counts.size(); ++i)
+            counts[0].merge(counts[i]);
+        print_stats(counts[0], *vocab, top);
     }
-    return 0;
+    return rtn;
 }
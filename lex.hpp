@@ -0,0 +1,1101 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_HPP
+#define LEX_HPP
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <cassert>
+
+#include "unicode.hpp"
+#include "counters.hpp"
+
+namespace lak
+{
+    using std::string;
+    using std::vector;
+    using std::unordered_map;
+    using std::shared_ptr;
+    using std::make_shared;
+    using std::ostream;
+    using std::istream;
+
+    template<typename T>
+    inline void write_pod(ostream &strm, const T &val)
+    {
+        strm.write((const char *)&val, sizeof(T));
+    }
+
+    template<typename T>
+    inline bool read_pod(istream &strm, T &val)
+    {
+        return (bool)strm.read((char *)&val, sizeof(T));
+    }
+
+    inline void write_string(ostream &strm, const string &str)
+    {
+        write_pod(strm, (uint32_t)str.size());
+        strm.write(str.data(), str.size());
+    }
+
+    inline bool read_string(istream &strm, string &str)
+    {
+        uint32_t size = 0;
+        if (!read_pod(strm, size)) return false;
+        str.resize(size);
+        return (bool)strm.read(&str[0], size);
+    }
+
+    template<typename T>
+    inline void write_vector(ostream &strm, const vector<T> &vec)
+    {
+        write_pod(strm, (uint32_t)vec.size());
+        strm.write((const char *)vec.data(), vec.size() * sizeof(T));
+    }
+
+    template<typename T>
+    inline bool read_vector(istream &strm, vector<T> &vec)
+    {
+        uint32_t size = 0;
+        if (!read_pod(strm, size)) return false;
+        vec.resize(size);
+        return (bool)strm.read((char *)vec.data(), size * sizeof(T));
+    }
+
+    // 64bit FNV-1a
+    inline uint64_t fnv1a(const char *data, size_t size, uint64_t hash = 0xCBF29CE484222325ULL)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= (uint8_t)data[i];
+            hash *= 0x100000001B3ULL;
+        }
+        return hash;
+    }
+
+    inline uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline uint64_t hash_word(uint64_t k)
+    {
+        k *= 0x87C37B91114253D5ULL;
+        k = rotl(k, 31);
+        return k * 0x4CF5AD432745937FULL;
+    }
+
+    // 64bit hash for checksums and content addressing, not cryptographic. four independent
+    // lanes of 8 bytes each so it isn't bound by multiply latency like fnv1a
+    inline uint64_t hash64(const char *data, size_t size, uint64_t seed = 0)
+    {
+        const uint64_t prime = 0x9E3779B97F4A7C15ULL;
+        uint64_t lane[4] = {seed ^ prime, seed + prime, seed ^ (prime >> 1), seed - prime};
+        const uint64_t total = size;
+        for (; size >= 32; data += 32, size -= 32)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                uint64_t k;
+                std::memcpy(&k, data + i * 8, 8);
+                lane[i] = rotl(lane[i] ^ hash_word(k), 27) * prime;
+            }
+        }
+        uint64_t h = total * prime;
+        for (int i = 0; i < 4; ++i)
+            h = rotl(h ^ hash_word(lane[i]), 27) * prime;
+        for (; size >= 8; data += 8, size -= 8)
+        {
+            uint64_t k;
+            std::memcpy(&k, data, 8);
+            h = rotl(h ^ hash_word(k), 27) * prime;
+        }
+        if (size > 0)
+        {
+            uint64_t k = 0;
+            std::memcpy(&k, data, size);
+            h = rotl(h ^ hash_word(k), 27) * prime;
+        }
+        // final avalanche
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        return h ^ (h >> 33);
+    }
+
+    template<typename T>
+    struct suffix_trie_t
+    {
+        string key;
+        vector<T> values;
+        unordered_map<char, shared_ptr<suffix_trie_t<T>>> children;
+
+        suffix_trie_t() {}
+        suffix_trie_t(const vector<T> &val) : values(val) {}
+        suffix_trie_t(vector<T> &&val) : values(val) {}
+        suffix_trie_t(const string str) : key(str) {}
+        suffix_trie_t(const string str, const vector<T> &val) : key(str), values(val) {}
+        suffix_trie_t(const string str, vector<T> &&val) : key(str), values(val) {}
+
+        inline shared_ptr<suffix_trie_t<T>> find_partial(const char c, lex::counter_batch_t *counters = nullptr) const
+        {
+            count_nodes(counters, 1);
+            if (auto &&it = children.find(c); it != children.end())
+                return it->second;
+            return nullptr;
+        }
+
+        inline shared_ptr<suffix_trie_t<T>> operator[](const char c) const
+        {
+            return find_partial(c);
+        }
+
+        inline shared_ptr<suffix_trie_t<T>> find_exact(const string str, lex::counter_batch_t *counters = nullptr) const
+        {
+            // walk down the trie, each child consumes its whole key
+            shared_ptr<suffix_trie_t<T>> rtn = nullptr;
+            const suffix_trie_t<T> *node = this;
+            size_t visited = 0;
+            for (size_t i = 0; i < str.size(); i += rtn->key.size(), node = rtn.get())
+            {
+                auto &&it = node->children.find(str[i]);
+                ++visited;
+                if (it == node->children.end() || str.compare(i, it->second->key.size(), it->second->key) != 0)
+                {
+                    count_nodes(counters, visited);
+                    return nullptr;
+                }
+                rtn = it->second;
+            }
+            count_nodes(counters, visited);
+            return rtn;
+        }
+
+        inline shared_ptr<suffix_trie_t<T>> operator[](const string str) const
+        {
+            return find_exact(str);
+        }
+
+        // find_exact without allocating or touching any reference counts. nodes visited are
+        // counted into counters if it's given
+        inline const suffix_trie_t<T> *find(std::string_view str, lex::counter_batch_t *counters = nullptr) const
+        {
+            const suffix_trie_t<T> *node = this;
+            size_t visited = 0;
+            for (size_t i = 0; i < str.size(); i += node->key.size(), ++visited)
+            {
+                auto &&it = node->children.find(str[i]);
+                if (it == node->children.end() || str.compare(i, it->second->key.size(), it->second->key) != 0)
+                {
+                    count_nodes(counters, visited);
+                    return nullptr;
+                }
+                node = it->second.get();
+            }
+            count_nodes(counters, visited);
+            return node == this ? nullptr : node;
+        }
+
+        // the longest prefix of str that was set in the trie, one node step per byte and no allocations
+        inline const suffix_trie_t<T> *find_longest(std::string_view str, size_t &length, lex::counter_batch_t *counters = nullptr) const
+        {
+            const suffix_trie_t<T> *node = this, *rtn = nullptr;
+            size_t visited = 0;
+            for (size_t i = 0, k = 0; i < str.size(); ++i, ++k)
+            {
+                if (k == node->key.size())
+                {
+                    // end of this node's key, step to the child
+                    auto &&it = node->children.find(str[i]);
+                    if (it == node->children.end()) break;
+                    node = it->second.get();
+                    k = 0;
+                    ++visited;
+                }
+                if (node->key[k] != str[i]) break;
+                if (k + 1 == node->key.size() && node->values.size() > 0)
+                {
+                    rtn = node;
+                    length = i + 1;
+                }
+            }
+            count_nodes(counters, visited);
+            return rtn;
+        }
+
+        static inline void count_nodes(lex::counter_batch_t *counters, size_t visited)
+        {
+            if (counters != nullptr) counters->add(lex::COUNT_TRIE_NODES, visited);
+            else lex::count(lex::COUNT_TRIE_NODES, visited);
+        }
+
+        inline bool isTerminal() const { return !children.size(); }
+
+        void set(const string str, vector<T> &&val) { set(str, val); }
+        void set(const string str, const vector<T> &val)
+        {
+            if (auto &&it = find_partial(str[0]); it != nullptr)
+            {
+                string &k = it->key;
+                if (str.size() >= k.size() && !std::strncmp(str.c_str(), k.c_str(), k.size()))
+                {
+                    if (str.size() == k.size())
+                    {
+                        // they are the same
+                        it->values = val;
+                    }
+                    else
+                    {
+                        // k is the suffix of str
+                        it->set(str.substr(k.size()), val);
+                    }
+                }
+                else
+                {
+                    // key slot is taken, but this str doesn't match current slot key.
+                    // must split slot into largest common substring
+                    size_t same = 1; // start at 1 because we know the first character is the same
+                    for (; same < str.size() && same < k.size() && str[same] == k[same]; ++same);
+
+                    string &&commonstr = str.substr(0, same); // part of the string that's the same
+                    string &&oldstr = k.substr(same);         // rest of the old key string
+                    shared_ptr<suffix_trie_t<T>> replacement;
+
+                    if (same == str.size())
+                    {
+                        // str was the suffix of k
+                        // therefore the replacement node is also the node to set
+                        replacement = make_shared<suffix_trie_t<T>>(commonstr, val);
+                    }
+                    else
+                    {
+                        // str and k have different endings
+                        // therefore we must add the new node and the replacement node seperately
+                        replacement = make_shared<suffix_trie_t<T>>(commonstr);
+                        string &&setstr = str.substr(same);   // rest of the set key string
+                        replacement->children[setstr[0]] = make_shared<suffix_trie_t<T>>(setstr, val);
+                    }
+
+                    it->key = oldstr;
+                    replacement->children[oldstr[0]] = it;
+
+                    children[commonstr[0]] = replacement;
+                }
+            }
+            else
+            {
+                children[str[0]] = make_shared<suffix_trie_t<T>>(str, val);
+            }
+        }
+
+        // binary form used by the compiled spec cache, each value goes through
+        // write_value(strm, value) and read_value(strm, value) -> bool
+        template<typename W>
+        void write(ostream &strm, const W &write_value) const
+        {
+            write_string(strm, key);
+            write_pod(strm, (uint32_t)values.size());
+            for (const T &value : values)
+                write_value(strm, value);
+            write_pod(strm, (uint32_t)children.size());
+            for (const auto &[childk, childv] : children)
+                childv->write(strm, write_value);
+        }
+
+        template<typename R>
+        bool read(istream &strm, const R &read_value)
+        {
+            uint32_t size = 0;
+            if (!read_string(strm, key) || !read_pod(strm, size))
+                return false;
+            values.clear();
+            for (uint32_t i = 0; i < size; ++i)
+            {
+                T value;
+                if (!read_value(strm, value)) return false;
+                values.push_back(std::move(value));
+            }
+            if (!read_pod(strm, size))
+                return false;
+            children.clear();
+            for (uint32_t i = 0; i < size; ++i)
+            {
+                auto child = make_shared<suffix_trie_t<T>>();
+                if (!child->read(strm, read_value) || child->key.empty()) return false;
+                children[child->key[0]] = child;
+            }
+            return true;
+        }
+
+        // calls func(str, values) for every string set in the trie
+        template<typename F>
+        void each(const F &func, const string &prefix = "") const
+        {
+            for (const auto &[childk, childv] : children)
+            {
+                string str = prefix + childv->key;
+                if (childv->values.size() > 0)
+                    func(str, childv->values);
+                childv->each(func, str);
+            }
+        }
+
+        // the indent is passed down instead of kept in a static so dumps are thread safe
+        void print(ostream &strm, size_t offset = 0) const
+        {
+            const string space(offset, ' ');
+            for (const auto &[childk, childv] : children)
+            {
+                strm << '\n' << space << "child "  << childv->key << " ";
+                childv->print(strm, offset + 2);
+            }
+        }
+
+        friend ostream &operator<<(ostream &strm, const suffix_trie_t &rhs)
+        {
+            rhs.print(strm);
+            return strm;
+        }
+    };
+}
+
+
+
+
+namespace lex
+{
+    using std::string;
+    using std::istream;
+    using std::ostream;
+    using std::vector;
+    using std::unordered_map;
+    using std::shared_ptr;
+
+    enum token_type { END, USER, KEYWORD, SYMBOL, STRING, COMMENT };
+
+    // the per kind counters follow token_type from USER on
+    static inline void count_kind(counter_batch_t &counters, token_type type)
+    {
+        counters.add((counter_t)(COUNT_USER + (type - USER)));
+    }
+
+    // UTF8 bytes start or continue multibyte sequences, which are decoded to find identifiers
+    enum char_class : uint8_t { SPACE, WORD, PUNCT, UTF8 };
+    struct delimiter_t { string close; char escape; };
+    // id is the vocabulary entry's index into vocabulary_t::entries, -1 for tokens that aren't entries
+    struct token_t { token_type type; string value; int id = -1; };
+    // a token pointing into the source buffer, rule is the index into vocabulary_t::rules that matched or -1
+    struct token_view_t { token_type type; int rule; std::string_view value; int id = -1; };
+
+    // the one table of token type names, "UNKNOWN" for anything out of range so a bad value
+    // read from a file can't index past it
+    static inline std::string_view type_name(token_type type)
+    {
+        static constexpr std::string_view names[] = {"END", "USER", "KEYWORD", "SYMBOL", "STRING", "COMMENT"};
+        return (unsigned)type < std::size(names) ? names[type] : "UNKNOWN";
+    }
+
+    static inline bool is_letter(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    static inline bool is_number(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    static inline bool is_hex(char c)
+    {
+        return is_number(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    }
+
+    static inline bool is_alphanumeric(char c)
+    {
+        return is_letter(c) || is_number(c);
+    }
+
+    // isspace in the C locale
+    static inline bool is_space(char c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    static inline bool is_symbol(char c)
+    {
+        return !(is_letter(c) || is_number(c) || is_space(c));
+    }
+
+    struct class_table_t
+    {
+        char_class table[256];
+
+        class_table_t() { reset(); }
+
+        void reset()
+        {
+            for (size_t i = 0; i < 256; ++i)
+            {
+                char c = (char)i;
+                if (i >= 0x80) table[i] = UTF8;
+                else if (is_alphanumeric(c) || c == '_') table[i] = WORD;
+                else table[i] = is_space(c) ? SPACE : PUNCT;
+            }
+        }
+
+        inline char_class operator[](const char c) const { return table[(uint8_t)c]; }
+        inline char_class &operator[](const char c) { return table[(uint8_t)c]; }
+    };
+
+    // a vocabulary entry, push is the index into vocabulary_t::modes to enter after lexing it
+    // (-1 for none) and pop leaves the current mode first
+    struct entry_t { token_type type; int32_t id = -1; int16_t push = -1; bool pop = false; };
+
+    // field by field so no padding reaches the cache and a bad type or pop byte is rejected.
+    // push is checked against the modes by load_tables
+    static inline void write_entry(ostream &strm, const entry_t &entry)
+    {
+        lak::write_pod(strm, (int32_t)entry.type);
+        lak::write_pod(strm, entry.id);
+        lak::write_pod(strm, entry.push);
+        lak::write_pod(strm, (uint8_t)entry.pop);
+    }
+
+    static inline bool read_entry(istream &strm, entry_t &entry)
+    {
+        int32_t type = 0;
+        uint8_t pop = 0;
+        if (!lak::read_pod(strm, type) || !lak::read_pod(strm, entry.id) || !lak::read_pod(strm, entry.push) ||
+            !lak::read_pod(strm, pop))
+            return false;
+        entry.type = (token_type)type;
+        entry.pop = pop != 0;
+        return type >= token_type::USER && type <= token_type::COMMENT && pop <= 1 && entry.id >= -1 && entry.push >= -1;
+    }
+
+    // a vocabulary and byte classes of its own, tokens push and pop modes to lex context
+    // dependent syntax like string interpolation or embedded languages
+    struct mode_t
+    {
+        string name;
+        lak::suffix_trie_t<entry_t> tokens;
+        class_table_t classes;
+        unordered_map<string, delimiter_t> delimiters;
+    };
+
+    struct dfa_rule_t
+    {
+        token_type type;   // type of the token this rule produces
+        int rule;          // index into vocabulary_t::rules or -1 for vocabulary literals and words
+        int id;            // entry id of vocabulary literals, -1 otherwise
+        delimiter_t delim; // STRING and COMMENT literals only
+    };
+
+    // table driven DFA, state 0 is the dead state
+    struct dfa_t
+    {
+        uint8_t classmap[256] = {};
+        uint32_t nclasses = 1;
+        uint32_t start = 0;
+        vector<uint32_t> next;   // next[state * nclasses + classmap[c]]
+        vector<int32_t> accept;  // index into rules or -1
+        vector<dfa_rule_t> rules;
+
+        // longest match at the start of [begin, end), returns the accepting rule or -1
+        inline int32_t match(const char *begin, const char *end, size_t &length) const
+        {
+            int32_t rtn = -1;
+            uint32_t state = start;
+            for (const char *it = begin; it != end;)
+            {
+                state = next[state * nclasses + classmap[(uint8_t)*it++]];
+                if (state == 0) break;
+                if (accept[state] >= 0)
+                {
+                    rtn = accept[state];
+                    length = it - begin;
+                }
+            }
+            return rtn;
+        }
+
+        void write(ostream &strm) const
+        {
+            strm.write((const char *)classmap, sizeof(classmap));
+            lak::write_pod(strm, nclasses);
+            lak::write_pod(strm, start);
+            lak::write_vector(strm, next);
+            lak::write_vector(strm, accept);
+            lak::write_pod(strm, (uint32_t)rules.size());
+            for (const dfa_rule_t &rule : rules)
+            {
+                lak::write_pod(strm, (int32_t)rule.type);
+                lak::write_pod(strm, (int32_t)rule.rule);
+                lak::write_pod(strm, (int32_t)rule.id);
+                lak::write_string(strm, rule.delim.close);
+                lak::write_pod(strm, rule.delim.escape);
+            }
+        }
+
+        bool read(istream &strm)
+        {
+            uint32_t size = 0;
+            if (!strm.read((char *)classmap, sizeof(classmap)) || !lak::read_pod(strm, nclasses) ||
+                !lak::read_pod(strm, start) || !lak::read_vector(strm, next) || !lak::read_vector(strm, accept) ||
+                !lak::read_pod(strm, size))
+                return false;
+            rules.resize(size);
+            for (dfa_rule_t &rule : rules)
+            {
+                int32_t type = 0, index = 0, id = 0;
+                if (!lak::read_pod(strm, type) || !lak::read_pod(strm, index) || !lak::read_pod(strm, id) ||
+                    !lak::read_string(strm, rule.delim.close) || !lak::read_pod(strm, rule.delim.escape))
+                    return false;
+                if (type < token_type::USER || type > token_type::COMMENT || index < -1 || id < -1)
+                    return false;
+                rule.type = (token_type)type;
+                rule.rule = index;
+                rule.id = id;
+            }
+
+            // match() indexes with all of these unchecked, rule and id are checked by load_tables
+            if (nclasses == 0 || nclasses > 256 || accept.empty() || next.size() != accept.size() * nclasses ||
+                start >= accept.size())
+                return false;
+            for (uint8_t c : classmap)
+                if (c >= nclasses) return false;
+            for (uint32_t state : next)
+                if (state >= accept.size()) return false;
+            for (int32_t rule : accept)
+                if (rule < -1 || rule >= (int32_t)rules.size()) return false;
+            return true;
+        }
+    };
+
+    // regex token rules, tried after the vocabulary literals and before plain words
+    struct rule_t { string name; string regex; };
+
+    // compiled tables, filled by load_builtin(), compile() or load_tables() and then shared
+    // read only by any number of lexers
+    struct vocabulary_t
+    {
+        vector<mode_t> modes = vector<mode_t>(1); // modes[0] is the main mode
+        // entry ids are dense and handed out in the order strings are first added to any mode,
+        // the same string has the same id in every mode. entries[id] is the entry's text
+        vector<string> entries;
+        unordered_map<string, int32_t> entry_ids;
+        vector<rule_t> rules;
+        dfa_t dfa; // main mode literals, rules and identifiers
+
+        inline int32_t entry_id(const string &str)
+        {
+            auto [it, added] = entry_ids.emplace(str, (int32_t)entries.size());
+            if (added) entries.push_back(str);
+            return it->second;
+        }
+
+        // sets str in modes[mode] under its entry id
+        inline void add_entry(size_t mode, const string &str, entry_t entry)
+        {
+            entry.id = entry_id(str);
+            modes[mode].tokens.set(str, {entry});
+        }
+    };
+
+    static inline bool hit_word_boundry(const class_table_t &classes, char c1, char c2)
+    {
+        if (c1 == 0) return false;
+        if (classes[c2] == SPACE) return true;
+        if ((classes[c1] == WORD) != (classes[c2] == WORD)) return true;
+        return false;
+    }
+
+    // reads up to and including delim.close, appending everything read to str
+    static inline void read_delimited(istream &strm, const delimiter_t &delim, string &str)
+    {
+        size_t start = str.size();
+        for (char c = strm.get(); strm.good(); c = strm.get())
+        {
+            str += c;
+            if (c == delim.escape && delim.escape != 0)
+            {
+                if (c = strm.get(); !strm.good()) break;
+                str += c;
+                start = str.size(); // escaped characters can't be part of the close
+            }
+            else if (str.size() - start >= delim.close.size() &&
+                !str.compare(str.size() - delim.close.size(), delim.close.size(), delim.close))
+                break;
+        }
+    }
+
+    // buffer version of read_delimited, returns the offset just past delim.close
+    static inline size_t find_delimited(std::string_view src, size_t pos, const delimiter_t &delim)
+    {
+        for (; pos < src.size(); ++pos)
+        {
+            if (src[pos] == delim.escape && delim.escape != 0)
+                ++pos;
+            else if (src.compare(pos, delim.close.size(), delim.close) == 0)
+                return pos + delim.close.size();
+        }
+        return src.size();
+    }
+
+    // the original byte at a time lexer, it doesn't follow mode pushes and pops
+    static inline token_t next_token(istream &strm, const mode_t &mode)
+    {
+        const lak::suffix_trie_t<entry_t> &tokens = mode.tokens;
+        const class_table_t &classes = mode.classes;
+        for (;;)
+        {
+            string str = "";
+            token_t rtn = { END, "" };
+            while (strm.good() && classes[(char)strm.peek()] == SPACE) strm.get(); // skip whitespace
+            for (char p = 0, c = strm.get(); strm.good(); c = strm.get())
+            {
+                auto &&it = tokens.find_exact(str);
+                if (hit_word_boundry(classes, p, c) || (it != nullptr && it->values.size() > 0 && it->values[0].type != token_type::KEYWORD &&
+                    (it->isTerminal() || (tokens.find_exact(str+c) == nullptr)) // terminal or next c makes it invalid
+                ))
+                {
+                    // reached the end of the token
+                    if (it != nullptr && it->values.size() > 0)
+                    {
+                        // we found a token!
+                        rtn.type = it->values[0].type;
+                        rtn.id = it->values[0].id;
+                        rtn.value = str;
+                        break;
+                    }
+                    else
+                    {
+                        // it wasn't a valid token
+                        rtn.type = token_type::USER;
+                        rtn.value = str;
+                        break;
+                    }
+                }
+                str += c;
+                p = c;
+            }
+            if (strm.good())
+                strm.unget();
+            else if (str.size() > 0)
+            {
+                // hit the end of the stream mid token
+                auto &&it = tokens.find_exact(str);
+                rtn.type = it != nullptr && it->values.size() > 0 ? it->values[0].type : token_type::USER;
+                rtn.id = it != nullptr && it->values.size() > 0 ? it->values[0].id : -1;
+                rtn.value = str;
+            }
+            if (rtn.type == token_type::STRING || rtn.type == token_type::COMMENT)
+            {
+                // we only found the opening delimiter, consume the rest
+                if (auto &&it = mode.delimiters.find(rtn.value); it != mode.delimiters.end())
+                    read_delimited(strm, it->second, rtn.value);
+                if (rtn.type == token_type::COMMENT)
+                    continue;
+            }
+            return rtn;
+        }
+    }
+
+    // length of the XID_Start (start) or XID_Continue (!start) code point at src[pos], 0 if it's neither
+    static inline size_t utf8_identifier(std::string_view src, size_t pos, bool start)
+    {
+        uint32_t cp = 0;
+        size_t length = decode_utf8(src, pos, cp);
+        return length > 0 && (start ? is_xid_start(cp) : is_xid_continue(cp)) ? length : 0;
+    }
+
+    // length of the first character of src if it can start an identifier, otherwise 0
+    static inline size_t identifier_start(std::string_view src, const class_table_t &table)
+    {
+        switch (table[src[0]])
+        {
+            case WORD: return 1;
+            case UTF8: return utf8_identifier(src, 0, true);
+            default: return 0;
+        }
+    }
+
+    // end of the identifier continuing from src[pos]
+    static inline size_t scan_identifier(std::string_view src, size_t pos, const class_table_t &table)
+    {
+        for (size_t n = 1; n > 0; pos += n)
+        {
+            // ASCII stays on the class table, only stop to decode at UTF8 bytes
+            while (pos < src.size() && table[src[pos]] == WORD) ++pos;
+            n = pos < src.size() && table[src[pos]] == UTF8 ? utf8_identifier(src, pos, false) : 0;
+        }
+        return pos;
+    }
+
+    // length of a token that isn't in the vocabulary and isn't an identifier: a run of symbol
+    // bytes, or a single non-identifier (or invalid) UTF-8 character
+    static inline size_t scan_unknown(std::string_view src, const class_table_t &table)
+    {
+        size_t length = 1;
+        if (table[src[0]] == UTF8)
+        {
+            uint32_t cp = 0;
+            length = std::max<size_t>(decode_utf8(src, 0, cp), 1);
+        }
+        else while (length < src.size() && table[src[length]] == PUNCT) ++length;
+        return length;
+    }
+
+    // a point in a lexer's token stream to rewind to, see lexer_t::checkpoint
+    struct checkpoint_t { size_t token; size_t generation; };
+
+    // lexes one source at a time against a shared vocabulary. a lexer isn't thread safe but any
+    // number of them can share a vocabulary from different threads
+    struct lexer_t
+    {
+        shared_ptr<const vocabulary_t> vocabulary;
+        std::string_view src; // what's left to lex
+        const mode_t *mode = nullptr;
+        vector<const mode_t *> mode_stack; // the modes below mode
+        string scratch; // delimiter lookups
+
+        // tokens lexed while checkpoints are held, replayed after a restore
+        vector<token_view_t> history;
+        size_t replay = 0; // index of the next token to return from history
+        size_t held = 0;   // checkpoints not yet released
+        size_t generation = 0; // bumped whenever the history is dropped, which invalidates checkpoints
+        counter_batch_t counters; // added to the thread's counters by reset and the destructor
+
+        lexer_t() {}
+        lexer_t(shared_ptr<const vocabulary_t> vocab, std::string_view source = {}) : vocabulary(std::move(vocab))
+        {
+            reset(source);
+        }
+        lexer_t(const lexer_t &) = default;
+        lexer_t(lexer_t &&) = default;
+        lexer_t &operator=(const lexer_t &) = default;
+        lexer_t &operator=(lexer_t &&) = default;
+        ~lexer_t() { flush_counters(); }
+
+        // start lexing source from the main mode
+        inline void reset(std::string_view source)
+        {
+            flush_counters();
+            src = source;
+            counters.mark(src.data());
+            mode = &vocabulary->modes[0];
+            mode_stack.clear();
+            drop_history();
+            held = 0;
+        }
+
+        // scan() and scan_dfa() only count what they can't work out afterwards. tokens are the
+        // sum of the kinds, token bytes how far src has moved and every identifier is one probe.
+        // each pass of either loop ends in a token or a comment, and a pass of scan() is an
+        // identifier or a longest match, so the rest of the passes ran the DFA
+        inline void flush_counters()
+        {
+            const uint64_t tokens = counters.get(COUNT_USER) + counters.get(COUNT_KEYWORDS) +
+                counters.get(COUNT_SYMBOLS) + counters.get(COUNT_STRINGS);
+            counters.add(COUNT_TOKENS, tokens);
+            counters.add(COUNT_TRIE_PROBES, counters.get(COUNT_IDENTIFIERS));
+            counters.add(COUNT_DFA_MATCHES, tokens + counters.get(COUNT_COMMENTS) -
+                counters.get(COUNT_IDENTIFIERS) - counters.get(COUNT_LONGEST_MATCHES));
+            counters.count_bytes(src.data());
+            counters.flush();
+        }
+
+        // checkpoints taken before this can't be restored
+        inline void drop_history()
+        {
+            history.clear();
+            replay = 0;
+            ++generation;
+        }
+
+        // the tokens after a checkpoint are kept until it's released, so restoring one is
+        // setting an index and the tokens are replayed instead of lexed again. mode and src
+        // stay where the furthest lexed token left them, which is where the replay ends up
+        inline checkpoint_t checkpoint()
+        {
+            ++held;
+            return {replay, generation};
+        }
+
+        // next() and next_dfa() return the tokens from cp onwards again. cp can't have been
+        // released with no other checkpoint held since, its tokens are gone
+        inline void restore(checkpoint_t cp)
+        {
+            assert(cp.generation == generation && cp.token <= history.size() && "lexer_t: restoring a released checkpoint");
+            replay = cp.token;
+        }
+
+        // every checkpoint has to be released once it's no longer going to be restored, the
+        // history is dropped when none are held and the replay has caught up
+        inline void release(checkpoint_t)
+        {
+            if (held > 0 && --held == 0 && replay == history.size())
+                drop_history();
+        }
+
+        // consumes the next token, replaying it if there is one after a restore
+        inline token_view_t next()
+        {
+            return buffered(&lexer_t::scan);
+        }
+
+        // next() using the vocabulary's DFA
+        inline token_view_t next_dfa()
+        {
+            return buffered(&lexer_t::scan_dfa);
+        }
+
+        inline token_view_t buffered(token_view_t (lexer_t::*scanner)())
+        {
+            if (replay < history.size())
+            {
+                counters.add(COUNT_REPLAYS);
+                token_view_t rtn = history[replay++];
+                if (replay == history.size() && held == 0)
+                    drop_history();
+                return rtn;
+            }
+            token_view_t rtn = (this->*scanner)();
+            if (held > 0)
+            {
+                counters.add(COUNT_ALLOCATIONS, history.size() == history.capacity());
+                history.push_back(rtn);
+                ++replay;
+            }
+            return rtn;
+        }
+
+        inline void push_mode(size_t index)
+        {
+            counters.add(COUNT_MODE_SWITCHES);
+            mode_stack.push_back(mode);
+            mode = &vocabulary->modes[index];
+        }
+
+        // popping the last mode stays in it
+        inline void pop_mode()
+        {
+            if (mode_stack.empty()) return;
+            counters.add(COUNT_MODE_SWITCHES);
+            mode = mode_stack.back();
+            mode_stack.pop_back();
+        }
+
+        // lexes the next token from the front of src, ignoring the checkpoint history
+        // identifiers are scanned to their end by class and then probed in the vocabulary once,
+        // symbols are the longest vocabulary match found in a single walk down the trie
+        // lexes with the current mode's tables, entries that push or pop swap the mode pointer
+        inline token_view_t scan()
+        {
+            // counters are uint64_t like src's size, so src is kept local for the counts not to
+            // make it reload after every one of them
+            std::string_view src = this->src;
+            for (;;)
+            {
+                const mode_t &m = *mode;
+                size_t length = 0;
+                while (length < src.size() && m.classes[src[length]] == SPACE) ++length; // skip whitespace
+                src.remove_prefix(length);
+                if (src.empty())
+                {
+                    this->src = src;
+                    return {token_type::END, -1, src};
+                }
+
+                const lak::suffix_trie_t<entry_t> *it = nullptr;
+                if (size_t start = identifier_start(src, m.classes); start > 0)
+                {
+                    length = scan_identifier(src, start, m.classes);
+                    it = m.tokens.find(src.substr(0, length), &counters);
+                    counters.add(COUNT_IDENTIFIERS);
+                }
+                else
+                {
+                    counters.add(COUNT_LONGEST_MATCHES);
+                    if (it = m.tokens.find_longest(src, length, &counters); it == nullptr)
+                    {
+                        length = scan_unknown(src, m.classes);
+                        counters.add(COUNT_UNKNOWN);
+                    }
+                }
+
+                token_view_t rtn = {token_type::USER, -1, {}};
+                if (it != nullptr && it->values.size() > 0)
+                {
+                    const entry_t &entry = it->values[0];
+                    rtn.type = entry.type;
+                    rtn.id = entry.id;
+                    if (entry.pop) pop_mode();
+                    if (entry.push >= 0) push_mode(entry.push);
+                }
+                if (rtn.type == token_type::STRING || rtn.type == token_type::COMMENT)
+                {
+                    // we only found the opening delimiter, consume the rest
+                    scratch.assign(src.data(), length);
+                    if (auto &&delim = m.delimiters.find(scratch); delim != m.delimiters.end())
+                        length = find_delimited(src, length, delim->second);
+                }
+                rtn.value = src.substr(0, length);
+                src.remove_prefix(length);
+                if (rtn.type != token_type::COMMENT)
+                {
+                    this->src = src;
+                    count_kind(counters, rtn.type);
+                    return rtn;
+                }
+                counters.add(COUNT_COMMENTS);
+            }
+        }
+
+        // scan() using the vocabulary's DFA. the DFA only covers the main mode, tokens that
+        // push or pop modes are lexed without doing so
+        inline token_view_t scan_dfa()
+        {
+            const vocabulary_t &vocab = *vocabulary;
+            const class_table_t &classes = vocab.modes[0].classes;
+            std::string_view src = this->src; // kept local like in scan()
+            for (;;)
+            {
+                size_t length = 0;
+                while (length < src.size() && classes[src[length]] == SPACE) ++length; // skip whitespace
+                src.remove_prefix(length);
+                if (src.empty())
+                {
+                    this->src = src;
+                    return {token_type::END, -1, src};
+                }
+
+                token_view_t rtn = {token_type::USER, -1, {}};
+                if (int32_t match = vocab.dfa.match(src.data(), src.data() + src.size(), length); match >= 0)
+                {
+                    const dfa_rule_t &rule = vocab.dfa.rules[match];
+                    rtn.type = rule.type;
+                    rtn.rule = rule.rule;
+                    rtn.id = rule.id;
+                    if (rule.type == token_type::STRING || rule.type == token_type::COMMENT)
+                        length = find_delimited(src, length, rule.delim);
+                }
+                else
+                {
+                    length = scan_unknown(src, classes);
+                    counters.add(COUNT_UNKNOWN);
+                }
+
+                rtn.value = src.substr(0, length);
+                src.remove_prefix(length);
+                if (rtn.type != token_type::COMMENT)
+                {
+                    this->src = src;
+                    count_kind(counters, rtn.type);
+                    return rtn;
+                }
+                counters.add(COUNT_COMMENTS);
+            }
+        }
+    };
+
+    // a token as an offset and length into the source, half the size of token_view_t
+    struct token_record_t { uint32_t offset; uint32_t length; int32_t id; int16_t rule; uint8_t type; };
+
+    // k token lookahead over a lexer without allocating, tokens are lexed capacity at a time
+    // into a ring of records. the source has to be smaller than 4GiB for the offsets
+    template<size_t capacity = 16>
+    struct lookahead_t
+    {
+        static_assert(capacity > 0 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+        lexer_t &lexer;
+        token_view_t (lexer_t::*scanner)();
+        const char *base; // where the offsets start, the lexer's source when the lookahead was made
+        token_record_t ring[capacity];
+        size_t head = 0;    // ring index of the current token
+        size_t count = 0;   // buffered tokens from head on
+        bool ended = false; // the END token is buffered, there's nothing left to lex
+
+        lookahead_t(lexer_t &lex, token_view_t (lexer_t::*next)() = &lexer_t::next)
+        : lexer(lex), scanner(next), base(lex.src.data()) {}
+
+        // lexes until the ring is full or holds the END token
+        inline void fill()
+        {
+            if (count == capacity || ended) return;
+            lexer.counters.add(COUNT_LOOKAHEAD_FILLS);
+            for (; count < capacity && !ended; ++count)
+            {
+                const token_view_t t = (lexer.*scanner)();
+                ring[(head + count) & (capacity - 1)] = {
+                    (uint32_t)(t.value.data() - base), (uint32_t)t.value.size(), t.id, (int16_t)t.rule, (uint8_t)t.type
+                };
+                ended = t.type == token_type::END;
+            }
+        }
+
+        // the n-th token after the current one, n < capacity. anything past the end is END
+        inline const token_record_t &record(size_t n = 0)
+        {
+            // the ring can't hold it, it would come back as whatever token is last in the ring
+            assert(n < capacity && "lookahead_t: peeking past the capacity");
+            lexer.counters.add(COUNT_LOOKAHEAD_PEEKS);
+            if (n >= count)
+            {
+                fill();
+                if (n >= count) n = count - 1; // ended, the last record is END
+            }
+            return ring[(head + n) & (capacity - 1)];
+        }
+
+        inline token_view_t peek(size_t n = 0)
+        {
+            const token_record_t &r = record(n);
+            return {(token_type)r.type, r.rule, std::string_view(base + r.offset, r.length), r.id};
+        }
+
+        // moves to the next token, END stays the current token once it's reached
+        inline void advance()
+        {
+            if (count == 0) fill();
+            if (ended && count == 1) return;
+            head = (head + 1) & (capacity - 1);
+            --count;
+        }
+    };
+}
+
+#endif
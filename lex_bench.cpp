@@ -0,0 +1,624 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "lex.hpp"
+#include "dfa.hpp"
+#include "spec.hpp"
+#include "input.hpp"
+#include "binary.hpp"
+#include "gen/builtin_scanner.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+using std::string;
+using std::vector;
+
+// source-like text built from the builtin vocabulary, identifiers and numbers
+static string make_input(size_t size, uint32_t seed)
+{
+    const vector<string> symbols = {"(", ")", ";", ",", "=", "==", "+", "+=", "-", "->", "*", "&&", "||", "!=", "<=", "[", "]", "."};
+    const vector<string> keywords = {"for", "while", "if", "return", "const", "struct", "class", "break"};
+    std::mt19937 rng(seed);
+    string rtn;
+    rtn.reserve(size + 64);
+    while (rtn.size() < size)
+    {
+        switch (rng() % 8)
+        {
+            case 0: rtn += keywords[rng() % keywords.size()]; break;
+            case 1: case 2: case 3:
+            {
+                for (size_t len = 1 + rng() % 12; len-- > 0;)
+                    rtn += (char)('a' + rng() % 26);
+            } break;
+            case 4: rtn += std::to_string(rng() % 100000); break;
+            default: rtn += symbols[rng() % symbols.size()]; break;
+        }
+        rtn += rng() % 10 == 0 ? '\n' : ' ';
+    }
+    return rtn;
+}
+
+// identifiers of exactly length characters with the occasional keyword, utf8 mixes in some 2 and 3 byte letters
+static string make_identifiers(size_t size, size_t length, uint32_t seed, bool utf8 = false)
+{
+    const vector<string> letters = {"\u00E9", "\u00F6", "\u00DF", "\u03A9", "\u0436", "\u6771"};
+    std::mt19937 rng(seed);
+    string rtn;
+    rtn.reserve(size + length * 3 + 1);
+    while (rtn.size() < size)
+    {
+        if (rng() % 8 == 0)
+            rtn += "return";
+        else for (size_t i = 0; i < length; ++i)
+        {
+            if (utf8 && rng() % 4 == 0)
+                rtn += letters[rng() % letters.size()];
+            else
+                rtn += (char)('a' + rng() % 26);
+        }
+        rtn += ' ';
+    }
+    return rtn;
+}
+
+// operators only, drawn from symbols
+static string make_operators(size_t size, const vector<string> &symbols, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    string rtn;
+    rtn.reserve(size + 8);
+    while (rtn.size() < size)
+    {
+        rtn += symbols[rng() % symbols.size()];
+        rtn += ' ';
+    }
+    return rtn;
+}
+
+// comment heavy source, line and block comments around short runs of code
+static string make_comments(size_t size, uint32_t seed)
+{
+    const vector<string> words = {"the", "lexer", "returns", "a", "token", "for", "each", "match", "in", "source", "text"};
+    std::mt19937 rng(seed);
+    string rtn;
+    rtn.reserve(size + 256);
+    while (rtn.size() < size)
+    {
+        const bool block = rng() % 3 == 0;
+        rtn += block ? "/* " : "// ";
+        for (size_t n = 4 + rng() % 12; n-- > 0;)
+        {
+            rtn += words[rng() % words.size()];
+            rtn += block && rng() % 6 == 0 ? '\n' : ' ';
+        }
+        rtn += block ? "*/\n" : "\n";
+        rtn += "x = y + " + std::to_string(rng() % 1000) + ";\n";
+    }
+    return rtn;
+}
+
+// few long tokens, string literals of up to 4KB and identifiers of up to 256 characters
+static string make_long_tokens(size_t size, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    string rtn;
+    rtn.reserve(size + 4096 + 256);
+    while (rtn.size() < size)
+    {
+        for (size_t len = 64 + rng() % 192; len-- > 0;)
+            rtn += (char)('a' + rng() % 26);
+        rtn += " = \"";
+        for (size_t len = 256 + rng() % 3840; len-- > 0;)
+        {
+            // the odd escaped quote so the escape path gets used
+            if (rng() % 64 == 0) rtn += "\\\"";
+            else rtn += rng() % 8 == 0 ? ' ' : (char)('a' + rng() % 26);
+        }
+        rtn += "\";\n";
+    }
+    return rtn;
+}
+
+// runs whose name contains this, everything if it's empty
+static string filter;
+// timed repetitions after one warm up run
+static int reps = 7;
+
+struct bench_result_t
+{
+    string name;
+    size_t bytes = 0;
+    size_t ops = 0;
+    double median = 0;
+    double min = 0;
+    double spread = 0; // standard deviation over the median
+};
+
+// every run so far, for --json and --baseline
+static vector<bench_result_t> results;
+
+// ops is whatever func counts, tokens or lookups, and bytes the input it goes through or 0.
+// rates are from the median run, the spread is the standard deviation over the median
+template<typename F>
+static void bench(const char *name, size_t bytes, F &&func)
+{
+    if (!filter.empty() && std::string_view(name).find(filter) == std::string_view::npos)
+        return;
+    const lex::counters_t before = lex::counters_snapshot();
+    size_t ops = func();
+    const lex::counters_t counted = lex::counters_snapshot() - before;
+    vector<double> times;
+    for (int rep = 0; rep < reps; ++rep)
+    {
+        auto start = std::chrono::steady_clock::now();
+        ops = func();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        times.push_back(elapsed.count());
+    }
+    std::sort(times.begin(), times.end());
+    const double median = times.size() % 2 ? times[times.size() / 2] : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+    double mean = 0, variance = 0;
+    for (double t : times) mean += t / times.size();
+    for (double t : times) variance += (t - mean) * (t - mean) / times.size();
+    char rate[32] = "          -     ";
+    if (bytes > 0)
+        std::snprintf(rate, sizeof(rate), "%10.1f MB/s", bytes / median / 1e6);
+    const double spread = median > 0 ? std::sqrt(variance) / median : 0.0;
+    std::printf("%-24s %s %9.2f ns/op %12.0f ops/s  min %8.3f ms  median %8.3f ms  +-%5.1f%%  (%zu ops)\n",
+        name, rate, median * 1e9 / std::max<size_t>(ops, 1), ops / median, times[0] * 1e3, median * 1e3,
+        spread * 100, ops);
+    if (lex::counters_enabled)
+    {
+        // what one run counted, from the warm up
+        std::printf("   ");
+        for (size_t i = 0; i < lex::COUNTER_COUNT; ++i)
+            if (counted.values[i] > 0)
+                std::printf(" %s %llu", lex::counter_names[i], (unsigned long long)counted.values[i]);
+        std::printf("\n");
+    }
+    std::fflush(stdout);
+    results.push_back({name, bytes, ops, median, times[0], spread});
+}
+
+template<typename F>
+static void bench(const char *name, const string &input, F &&func)
+{
+    bench(name, input.size(), std::forward<F>(func));
+}
+
+// one result per line so baselines diff well. names are plain ASCII without quotes
+static bool write_results(const string &path)
+{
+    std::ofstream out(path);
+    char line[512];
+    out << "{\"compiler\":\"" << __VERSION__ << "\",\"reps\":" << reps << ",\"results\":[\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const bench_result_t &r = results[i];
+        std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"bytes\":%zu,\"ops\":%zu,\"median\":%.9g,\"min\":%.9g,\"spread\":%.6g}%s\n",
+            r.name.c_str(), r.bytes, r.ops, r.median, r.min, r.spread, i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "]}\n";
+    return out.good();
+}
+
+// reads back what write_results wrote, one result per line
+static bool read_results(const string &path, vector<bench_result_t> &rtn, string &compiler)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    auto field = [](const string &line, const char *key) -> string
+    {
+        const string pattern = "\"" + string(key) + "\":";
+        size_t begin = line.find(pattern);
+        if (begin == string::npos)
+            return {};
+        begin += pattern.size();
+        if (line[begin] == '"')
+            return line.substr(begin + 1, line.find('"', begin + 1) - begin - 1);
+        return line.substr(begin, line.find_first_of(",}", begin) - begin);
+    };
+    for (string line; std::getline(in, line);)
+    {
+        if (line.find("\"compiler\":") != string::npos)
+            compiler = field(line, "compiler");
+        if (line.find("\"name\":") == string::npos)
+            continue;
+        bench_result_t r;
+        r.name = field(line, "name");
+        r.bytes = std::strtoull(field(line, "bytes").c_str(), nullptr, 10);
+        r.ops = std::strtoull(field(line, "ops").c_str(), nullptr, 10);
+        r.median = std::strtod(field(line, "median").c_str(), nullptr);
+        r.min = std::strtod(field(line, "min").c_str(), nullptr);
+        r.spread = std::strtod(field(line, "spread").c_str(), nullptr);
+        rtn.push_back(r);
+    }
+    return true;
+}
+
+// a run is a regression when its median is slower than the baseline's by more than threshold
+// and by more than 3 standard deviations of the combined noise of both runs, and its fastest
+// run is slower too. noisy benchmarks need a bigger slowdown before they fail.
+// per op times are compared so inputs of a different size still line up
+static size_t compare_results(const vector<bench_result_t> &baseline, double threshold)
+{
+    size_t regressions = 0;
+    std::printf("\n%-24s %12s %12s %8s %8s\n", "compared to baseline", "base ns/op", "ns/op", "change", "limit");
+    for (const bench_result_t &now : results)
+    {
+        auto base = std::find_if(baseline.begin(), baseline.end(), [&](const bench_result_t &r) { return r.name == now.name; });
+        if (base == baseline.end() || base->ops == 0 || now.ops == 0)
+        {
+            std::printf("%-24s %12s\n", now.name.c_str(), "new");
+            continue;
+        }
+        const double base_op = base->median / base->ops, now_op = now.median / now.ops;
+        const double change = now_op / base_op - 1;
+        const double limit = std::max(threshold, 3 * std::sqrt(base->spread * base->spread + now.spread * now.spread));
+        const bool slower = change > limit && now.min / now.ops > base->min / base->ops * (1 + threshold);
+        regressions += slower;
+        std::printf("%-24s %12.2f %12.2f %+7.1f%% %7.1f%%%s\n", now.name.c_str(), base_op * 1e9, now_op * 1e9,
+            change * 100, limit * 100, slower ? "  REGRESSION" : change < -limit ? "  faster" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv)
+{
+    string json_path, baseline_path;
+    double threshold = 0.05;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i] == string("--reps") && i + 1 < argc) reps = std::max(1, std::atoi(argv[++i]));
+        else if (argv[i] == string("--json") && i + 1 < argc) json_path = argv[++i];
+        else if (argv[i] == string("--baseline") && i + 1 < argc) baseline_path = argv[++i];
+        else if (argv[i] == string("--threshold") && i + 1 < argc) threshold = std::atof(argv[++i]) / 100;
+        else if (argv[i][0] != '-') filter = argv[i];
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--reps n] [--json results.json] [--baseline results.json] [--threshold percent] [name filter]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // read up front so a bad path fails before the benchmarks run
+    vector<bench_result_t> baseline;
+    if (string compiler; !baseline_path.empty())
+    {
+        if (!read_results(baseline_path, baseline, compiler))
+        {
+            std::fprintf(stderr, "can't read baseline %s\n", baseline_path.c_str());
+            return 1;
+        }
+        if (compiler != __VERSION__)
+            std::fprintf(stderr, "baseline was built with %s, not %s\n", compiler.c_str(), __VERSION__);
+    }
+
+    auto vocab = std::make_shared<lex::vocabulary_t>();
+    lex::load_builtin(*vocab);
+    if (string error; !lex::build_dfa(*vocab, error))
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    const auto builtin = vocab;
+
+    auto stream_tokens = [&](const string &input)
+    {
+        std::istringstream strm(input);
+        size_t count = 0;
+        for (lex::token_t t = lex::next_token(strm, vocab->modes[0]); t.type != lex::token_type::END; t = lex::next_token(strm, vocab->modes[0]))
+            ++count;
+        return count;
+    };
+
+    auto buffer_tokens = [&](const string &input)
+    {
+        lex::lexer_t lexer(vocab, input);
+        size_t count = 0;
+        for (lex::token_view_t t = lexer.next(); t.type != lex::token_type::END; t = lexer.next())
+            ++count;
+        return count;
+    };
+
+    // the trie on its own, a mix of identifier like keys and operators
+    {
+        std::mt19937 rng(1);
+        vector<string> keys = {"<<=", ">>=", "->*", "...", "<=>", "<<", ">>", "::", "->", "+=", "&&", "||", "==", "!="};
+        while (keys.size() < 50000)
+        {
+            string key;
+            for (size_t len = 2 + rng() % 15; len-- > 0;)
+                key += (char)('a' + rng() % 26);
+            keys.push_back(key);
+        }
+        vector<string> misses;
+        for (const string &key : keys)
+            misses.push_back(key + "_");
+        const vector<lex::entry_t> value = {{lex::token_type::KEYWORD}};
+
+        lak::suffix_trie_t<lex::entry_t> trie;
+        auto fill = [&]
+        {
+            trie = lak::suffix_trie_t<lex::entry_t>();
+            for (const string &key : keys)
+                trie.set(key, value);
+            return keys.size();
+        };
+        bench("trie set", 0, fill);
+        fill();
+        bench("trie find_exact", 0, [&]
+        {
+            size_t found = 0;
+            for (const string &key : keys)
+                found += trie.find_exact(key) != nullptr;
+            return found;
+        });
+        bench("trie find_exact miss", 0, [&]
+        {
+            size_t found = 0;
+            for (const string &key : misses)
+                found += trie.find_exact(key) == nullptr;
+            return found;
+        });
+        bench("trie find", 0, [&]
+        {
+            size_t found = 0;
+            for (const string &key : keys)
+                found += trie.find(key) != nullptr;
+            return found;
+        });
+        bench("trie find_partial", 0, [&]
+        {
+            // one step down per character, as next_token(istream &) walks the trie
+            size_t steps = 0;
+            for (const string &key : keys)
+            {
+                size_t i = 0;
+                for (auto node = trie.find_partial(key[0]); node != nullptr; node = i < key.size() ? node->find_partial(key[i]) : nullptr)
+                {
+                    i += node->key.size();
+                    ++steps;
+                }
+            }
+            return steps;
+        });
+    }
+
+    // per byte cost of the keyword path as identifiers get longer
+    for (size_t length : {4, 16, 64, 256})
+    {
+        const string input = make_identifiers(4 << 20, length, 1);
+        string name = "stream ident " + std::to_string(length);
+        bench(name.c_str(), input, [&] { return stream_tokens(input); });
+        name = "buffer ident " + std::to_string(length);
+        bench(name.c_str(), input, [&] { return buffer_tokens(input); });
+    }
+
+    // UTF-8 identifiers only decode their non ASCII characters
+    for (size_t length : {4, 16})
+    {
+        const string input = make_identifiers(4 << 20, length, 1, true);
+        string name = "buffer utf8 " + std::to_string(length);
+        bench(name.c_str(), input, [&] { return buffer_tokens(input); });
+    }
+
+    const string input = make_input(8 << 20, 1);
+
+    // input stage, validation of UTF-8 and transcoding to it
+    const string utf8 = make_identifiers(8 << 20, 16, 1, true);
+    bench("validate ascii", input, [&] { return lex::validate_utf8(input) == std::string_view::npos ? 0 : 1; });
+    bench("validate utf8", utf8, [&] { return lex::validate_utf8(utf8) == std::string_view::npos ? 0 : 1; });
+    string latin1;
+    lex::latin1_to_utf8(input, latin1); // ASCII, the common case
+    bench("latin1 to utf8", input, [&] { lex::latin1_to_utf8(input, latin1); return (size_t)0; });
+    string utf16;
+    for (char c : input)
+        utf16 += {c, '\0'};
+    bench("utf16le to utf8", utf16, [&] { return lex::utf16_to_utf8(utf16, false, latin1) == std::string_view::npos ? 0 : 1; });
+
+    bench("next_token stream", input, [&] { return stream_tokens(input); });
+    bench("next_token buffer", input, [&] { return buffer_tokens(input); });
+
+    // speculative parsing, every run of 16 tokens is read, rewound and read again
+    bench("next_token backtrack", input, [&]
+    {
+        lex::lexer_t lexer(vocab, input);
+        size_t count = 0;
+        for (bool done = false; !done;)
+        {
+            lex::checkpoint_t cp = lexer.checkpoint();
+            for (int i = 0; i < 16 && lexer.next().type != lex::token_type::END; ++i);
+            lexer.restore(cp);
+            for (int i = 0; i < 16 && !done; ++i)
+            {
+                done = lexer.next().type == lex::token_type::END;
+                count += !done;
+            }
+            lexer.release(cp);
+        }
+        return count;
+    });
+
+    // LL(3) style parsing, three tokens of lookahead before consuming each one
+    bench("next_token lookahead", input, [&]
+    {
+        lex::lexer_t lexer(vocab, input);
+        lex::lookahead_t<> ahead(lexer);
+        size_t count = 0;
+        for (; ahead.peek().type != lex::token_type::END; ahead.advance(), ++count)
+            ahead.peek(2);
+        return count;
+    });
+
+    // binary token streams, encoding while lexing and iterating the encoded tokens
+    lex::binary_encoder_t encoder;
+    auto encode = [&]
+    {
+        encoder.reset("input", input, *vocab);
+        lex::lexer_t lexer(vocab, input);
+        for (lex::token_view_t t = lexer.next(); t.type != lex::token_type::END; t = lexer.next())
+            encoder.add(t);
+        return (size_t)encoder.count;
+    };
+    bench("binary encode", input, encode);
+    string encoded;
+    {
+        encode();
+        lex::writer_t out(encoded);
+        string error;
+        encoder.finish(out, error);
+    }
+    bench("binary decode", encoded, [&]
+    {
+        lex::binary_reader_t reader(encoded);
+        lex::binary_file_t file;
+        string error;
+        size_t count = 0;
+        lex::binary_token_t t;
+        while (reader.next(file, error))
+            for (auto cursor = file.tokens(); cursor.next(t);)
+                count += t.value.size() > 0;
+        return count;
+    });
+
+    // NDJSON output of every token to /dev/null
+    bench("ndjson", input, [&]
+    {
+        const int fd = ::open("/dev/null", O_WRONLY);
+        size_t count = 0;
+        {
+            lex::writer_t out(fd);
+            lex::lexer_t lexer(vocab, input);
+            for (lex::token_view_t t = lexer.next(); t.type != lex::token_type::END; t = lexer.next(), ++count)
+            {
+                lex::write_json_token(out, *vocab, t, input.data(), true);
+                out.put('\n');
+            }
+        }
+        ::close(fd);
+        return count;
+    });
+
+    // independent lexers sharing one vocabulary, each thread lexes the whole input
+    const size_t threads = std::max(2u, std::min(4u, std::thread::hardware_concurrency()));
+    const string shared_input = [&] { string rtn; for (size_t i = 0; i < threads; ++i) rtn += input; return rtn; }();
+    bench("next_token threads", shared_input, [&]
+    {
+        vector<size_t> counts(threads);
+        vector<std::thread> pool;
+        for (size_t i = 0; i < threads; ++i)
+            pool.emplace_back([&, i] { counts[i] = buffer_tokens(input); });
+        size_t count = 0;
+        for (size_t i = 0; i < threads; ++i)
+        {
+            pool[i].join();
+            count += counts[i];
+        }
+        return count;
+    });
+
+    bench("dfa", input, [&]
+    {
+        lex::lexer_t lexer(vocab, input);
+        size_t count = 0;
+        for (lex::token_view_t t = lexer.next_dfa(); t.type != lex::token_type::END; t = lexer.next_dfa())
+            ++count;
+        return count;
+    });
+
+    bench("lexgen", input, [&]
+    {
+        std::string_view src = input;
+        size_t count = 0;
+        for (scanner::token_t t = scanner::next_token(src); t.type != scanner::END; t = scanner::next_token(src))
+            ++count;
+        return count;
+    });
+
+    // long operators, next_token(istream &) splits "..." because ".." isn't in the vocabulary
+    const vector<string> operators = {"<<=", ">>=", "->*", "...", "<=>", "<<", ">>", "::", "->", "+=", "&&", "<", "=", "."};
+    auto operator_vocab = std::make_shared<lex::vocabulary_t>(*vocab);
+    for (const string &str : operators)
+        operator_vocab->add_entry(0, str, {lex::token_type::SYMBOL});
+    vocab = operator_vocab;
+    const string ops = make_operators(4 << 20, operators, 1);
+    bench("stream operators", ops, [&] { return stream_tokens(ops); });
+    bench("buffer operators", ops, [&] { return buffer_tokens(ops); });
+
+    // end to end over each kind of input, next_token(istream &) is the baseline the others are
+    // measured against
+    auto suite = [&](const char *label, const string &text, std::shared_ptr<lex::vocabulary_t> suite_vocab)
+    {
+        vocab = suite_vocab;
+        string name = string("baseline ") + label;
+        bench(name.c_str(), text, [&] { return stream_tokens(text); });
+        name = string("buffer ") + label;
+        bench(name.c_str(), text, [&] { return buffer_tokens(text); });
+        name = string("dfa ") + label;
+        bench(name.c_str(), text, [&]
+        {
+            lex::lexer_t lexer(vocab, text);
+            size_t count = 0;
+            for (lex::token_view_t t = lexer.next_dfa(); t.type != lex::token_type::END; t = lexer.next_dfa())
+                ++count;
+            return count;
+        });
+    };
+    auto c_vocab = std::make_shared<lex::vocabulary_t>();
+    if (string error; !lex::load_spec("spec/c.lexspec", false, *c_vocab, error) || !lex::build_dfa(*operator_vocab, error))
+    {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    suite("identifiers", make_identifiers(8 << 20, 8, 2), builtin);
+    suite("operators", ops, operator_vocab);
+    suite("comments", make_comments(8 << 20, 3), c_vocab);
+    suite("long tokens", make_long_tokens(8 << 20, 4), c_vocab);
+
+    if (!json_path.empty() && !write_results(json_path))
+    {
+        std::fprintf(stderr, "can't write %s\n", json_path.c_str());
+        return 1;
+    }
+    if (!baseline_path.empty())
+    {
+        if (size_t regressions = compare_results(baseline, threshold); regressions > 0)
+        {
+            std::fflush(stdout);
+            std::fprintf(stderr, "%zu benchmarks regressed\n", regressions);
+            return 2;
+        }
+    }
+
+    return 0;
+}
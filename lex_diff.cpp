@@ -0,0 +1,589 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// lex_diff lexes the same source with every engine and reports the first token where one of
+// them disagrees with the engine it's meant to match, with the source around it. given no
+// files it lexes generated sources with random mutations. built with -DLEX_FUZZ it's a
+// libFuzzer target instead, see make fuzz
+
+#include "lex.hpp"
+#include "dfa.hpp"
+#include "spec.hpp"
+#include "input.hpp"
+#include "writer.hpp"
+#include "binary.hpp"
+#include "corpus.hpp"
+#include "token_cache.hpp"
+#include "gen/builtin_scanner.hpp"
+#include "gen/c_scanner.hpp"
+#include "gen/js_scanner.hpp"
+
+#include <random>
+#include <thread>
+
+using std::cerr;
+using std::string;
+using std::vector;
+using std::shared_ptr;
+using namespace std::string_literals;
+
+// a token from any engine as an offset into the source, so engines that copy compare the same
+struct diff_token_t
+{
+    lex::token_type type;
+    int rule;
+    int id;
+    size_t offset;
+    size_t length;
+
+    bool operator==(const diff_token_t &other) const
+    {
+        return type == other.type && rule == other.rule && id == other.id && offset == other.offset && length == other.length;
+    }
+    bool operator!=(const diff_token_t &other) const { return !(*this == other); }
+};
+
+using diff_tokens_t = vector<diff_token_t>;
+using vocab_ptr_t = shared_ptr<const lex::vocabulary_t>;
+
+static diff_token_t from_view(const lex::token_view_t &t, std::string_view src)
+{
+    return {t.type, t.rule, t.id, (size_t)(t.value.data() - src.data()), t.value.size()};
+}
+
+// every engine ends with an END token at the end of the source
+
+static void lex_trie(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out)
+{
+    lex::lexer_t lexer(vocab, src);
+    for (lex::token_view_t t = lexer.next();; t = lexer.next())
+    {
+        out.push_back(from_view(t, src));
+        if (t.type == lex::token_type::END) break;
+    }
+}
+
+// next() with a checkpoint before every token, looking a different distance ahead each time
+// and restoring, so most tokens come from the replay history
+static void lex_replay(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out)
+{
+    lex::lexer_t lexer(vocab, src);
+    for (size_t n = 0;; ++n)
+    {
+        lex::checkpoint_t cp = lexer.checkpoint();
+        for (size_t i = n % 5; i > 0 && lexer.next().type != lex::token_type::END; --i);
+        lexer.restore(cp);
+        const lex::token_view_t t = lexer.next();
+        lexer.release(cp);
+        out.push_back(from_view(t, src));
+        if (t.type == lex::token_type::END) break;
+    }
+}
+
+// the ring of token records lookahead_t keeps, peeking a different distance ahead each time
+static void lex_lookahead(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out)
+{
+    lex::lexer_t lexer(vocab, src);
+    lex::lookahead_t<8> ahead(lexer);
+    for (size_t n = 0;; ++n, ahead.advance())
+    {
+        ahead.peek(n % 8);
+        const lex::token_view_t t = ahead.peek();
+        out.push_back(from_view(t, src));
+        if (t.type == lex::token_type::END) break;
+    }
+}
+
+// trie tokens encoded to the binary format and read back
+static void lex_binary(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out)
+{
+    lex::binary_encoder_t encoder;
+    encoder.reset("diff", src, *vocab);
+    lex::lexer_t lexer(vocab, src);
+    for (lex::token_view_t t = lexer.next(); t.type != lex::token_type::END; t = lexer.next())
+        encoder.add(t);
+    string encoded, error;
+    {
+        lex::writer_t writer(encoded);
+        encoder.finish(writer, error);
+    }
+    lex::binary_reader_t reader(encoded);
+    lex::binary_file_t file;
+    if (reader.next(file, error))
+    {
+        lex::binary_token_t t;
+        for (auto cursor = file.tokens(); cursor.next(t);)
+            out.push_back({t.type, t.rule, t.id, (size_t)t.offset, t.value.size()});
+    }
+    out.push_back({lex::token_type::END, -1, -1, src.size(), 0});
+}
+
+static void lex_dfa(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out)
+{
+    lex::lexer_t lexer(vocab, src);
+    for (lex::token_view_t t = lexer.next_dfa();; t = lexer.next_dfa())
+    {
+        out.push_back(from_view(t, src));
+        if (t.type == lex::token_type::END) break;
+    }
+}
+
+// a scanner generated by lexgen, next is its next_token
+template<typename token_t, token_t (*next)(std::string_view &)>
+static void lex_generated(const vocab_ptr_t &, std::string_view src, diff_tokens_t &out)
+{
+    const std::string_view source = src;
+    for (;;)
+    {
+        const token_t t = next(src);
+        out.push_back({(lex::token_type)t.type, t.rule, t.id, (size_t)(t.value.data() - source.data()), t.value.size()});
+        if ((lex::token_type)t.type == lex::token_type::END) break;
+    }
+}
+
+// the scanners lex_diff is built with, see gen/ in the Makefile
+struct generated_t
+{
+    const char *const *entry_names;
+    const char *const *rule_names;
+    void (*lex)(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out);
+};
+
+static const generated_t generated[] = {
+    {scanner::entry_names, scanner::rule_names, lex_generated<scanner::token_t, scanner::next_token>},
+    {c::entry_names, c::rule_names, lex_generated<c::token_t, c::next_token>},
+    {js::entry_names, js::rule_names, lex_generated<js::token_t, js::next_token>},
+};
+
+// the generated scanner for vocab, matched by its entries and rules so a scanner generated from
+// an older spec is left out rather than reported, nullptr if there isn't one
+static const generated_t *generated_for(const lex::vocabulary_t &vocab)
+{
+    for (const generated_t &gen : generated)
+    {
+        size_t entries = 0, rules = 0;
+        while (gen.entry_names[entries] != nullptr && entries < vocab.entries.size() && vocab.entries[entries] == gen.entry_names[entries]) ++entries;
+        while (gen.rule_names[rules] != nullptr && rules < vocab.rules.size() && vocab.rules[rules].name == gen.rule_names[rules]) ++rules;
+        if (gen.entry_names[entries] == nullptr && entries == vocab.entries.size() &&
+            gen.rule_names[rules] == nullptr && rules == vocab.rules.size())
+            return &gen;
+    }
+    return nullptr;
+}
+
+// the original next_token(istream &), tokens end where the stream is left
+static void lex_stream(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out)
+{
+    std::istringstream strm{string(src)};
+    for (;;)
+    {
+        const lex::token_t t = lex::next_token(strm, vocab->modes[0]);
+        const std::streamoff pos = strm.tellg();
+        const size_t end = pos < 0 ? src.size() : (size_t)pos;
+        out.push_back({t.type, -1, t.id, end - std::min(end, t.value.size()), t.value.size()});
+        if (t.type == lex::token_type::END) break;
+    }
+}
+
+// the trie engine on several threads at once sharing one vocabulary, like lex --jobs. a thread
+// that differs from the first is the one compared
+static void lex_threads(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out)
+{
+    vector<diff_tokens_t> tokens(4);
+    vector<std::thread> threads;
+    for (size_t i = 0; i < tokens.size(); ++i)
+        threads.emplace_back([&, i] { lex_trie(vocab, src, tokens[i]); });
+    for (std::thread &thread : threads)
+        thread.join();
+    size_t which = 0;
+    for (size_t i = 1; i < tokens.size(); ++i)
+        if (tokens[i] != tokens[0]) which = i;
+    out = std::move(tokens[which]);
+}
+
+// a directory of its own for the token cache, removed on exit
+struct scratch_dir_t
+{
+    lex::fs::path path;
+    scratch_dir_t()
+    : path(lex::fs::temp_directory_path() / ("lex_diff." + std::to_string(std::random_device{}()))) {}
+    ~scratch_dir_t() { std::error_code ec; lex::fs::remove_all(path, ec); }
+};
+
+// trie tokens stored in the token cache and found again, read from the cached entry
+static void lex_cache(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out)
+{
+    static scratch_dir_t scratch;
+    const lex::token_cache_t cache(scratch.path, 16 << 20, *vocab, "diff");
+    lex::binary_encoder_t encoder;
+    encoder.reset("diff", src, *vocab);
+    lex::lexer_t lexer(vocab, src);
+    for (lex::token_view_t t = lexer.next(); t.type != lex::token_type::END; t = lexer.next())
+        encoder.add(t);
+    lak::mapped_file_t stored, found;
+    lex::binary_file_t section;
+    if (cache.store(encoder, stored, section) && cache.find(src, found, section))
+    {
+        lex::binary_token_t t;
+        for (auto cursor = section.tokens(); cursor.next(t);)
+            out.push_back({t.type, t.rule, t.id, (size_t)t.offset, t.value.size()});
+    }
+    out.push_back({lex::token_type::END, -1, -1, src.size(), 0});
+}
+
+struct engine_t
+{
+    const char *name;
+    const char *reference; // the engine it has to match, nullptr for the reference itself
+    void (*lex)(const vocab_ptr_t &vocab, std::string_view src, diff_tokens_t &out);
+    vocab_ptr_t vocab; // lexes with this instead of the loaded vocabulary if it's set
+    bool ascii = false; // only compared up to the first NUL or byte that isn't ASCII
+};
+
+// vocab without regex rules or modes, which the DFA, the trie engine and next_token(istream &)
+// lex the same way. next_token(istream &) only grows a token while the longer one is an entry,
+// so every prefix of a symbol is made an entry too
+static vocab_ptr_t literals_only(const lex::vocabulary_t &vocab)
+{
+    auto rtn = std::make_shared<lex::vocabulary_t>(vocab);
+    rtn->rules.clear();
+    rtn->modes.resize(1);
+    lak::suffix_trie_t<lex::entry_t> tokens;
+    vector<string> symbols;
+    vocab.modes[0].tokens.each([&](const string &str, const vector<lex::entry_t> &values)
+    {
+        vector<lex::entry_t> entries = values;
+        for (lex::entry_t &entry : entries)
+        {
+            entry.push = -1;
+            entry.pop = false;
+        }
+        tokens.set(str, entries);
+        if (!values.empty() && values[0].type != lex::token_type::KEYWORD)
+            symbols.push_back(str);
+    });
+    rtn->modes[0].tokens = std::move(tokens);
+    for (const string &str : symbols)
+    {
+        for (size_t length = 1; length < str.size(); ++length)
+        {
+            const string prefix = str.substr(0, length);
+            if (const auto *node = rtn->modes[0].tokens.find(prefix); node == nullptr || node->values.empty())
+                rtn->add_entry(0, prefix, {lex::token_type::SYMBOL});
+        }
+    }
+    if (string error; !lex::build_dfa(*rtn, error))
+    {
+        cerr << error << '\n';
+        return nullptr;
+    }
+    return rtn;
+}
+
+// the engines that can be compared for vocab. the trie engine has no regex rules and the DFA
+// and the generated scanner only lex the main mode, so with either the DFA is compared with
+// the generated scanner only, and against the trie engine on a copy of the vocabulary without
+// them. next_token(istream &) has neither too, and it reads UTF-8 byte by byte and takes a NUL
+// for the start of a token, so it's compared up to the first of either
+static vector<engine_t> engines_for(const lex::vocabulary_t &vocab)
+{
+    vector<engine_t> rtn = {
+        {"trie", nullptr, lex_trie, nullptr},
+        {"replay", "trie", lex_replay, nullptr},
+        {"lookahead", "trie", lex_lookahead, nullptr},
+        {"binary", "trie", lex_binary, nullptr},
+        {"threads", "trie", lex_threads, nullptr},
+        {"cache", "trie", lex_cache, nullptr},
+    };
+    const bool plain = vocab.modes.size() == 1 && vocab.rules.empty();
+    rtn.push_back({"dfa", plain ? "trie" : nullptr, lex_dfa, nullptr});
+    if (const generated_t *gen = generated_for(vocab))
+        rtn.push_back({"lexgen", "dfa", gen->lex, nullptr});
+    if (plain)
+        rtn.push_back({"stream", "trie", lex_stream, nullptr, true});
+    else if (vocab_ptr_t literals = literals_only(vocab))
+    {
+        rtn.push_back({"trie literals", nullptr, lex_trie, literals});
+        rtn.push_back({"dfa literals", "trie literals", lex_dfa, literals});
+        rtn.push_back({"stream literals", "trie literals", lex_stream, literals, true});
+    }
+    return rtn;
+}
+
+// src[begin, end) with everything but printable ASCII escaped
+static string escape(std::string_view src, size_t begin, size_t end)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    string rtn;
+    for (size_t i = begin; i < end && i < src.size(); ++i)
+    {
+        const uint8_t c = (uint8_t)src[i];
+        if (c == '\n') rtn += "\\n";
+        else if (c == '\t') rtn += "\\t";
+        else if (c == '\\') rtn += "\\\\";
+        else if (c >= 0x20 && c < 0x7F) rtn += (char)c;
+        else rtn += {'\\', 'x', hex[c >> 4], hex[c & 0xF]};
+    }
+    return rtn;
+}
+
+static string describe(const lex::vocabulary_t &vocab, std::string_view src, const diff_token_t *t)
+{
+    if (t == nullptr)
+        return "nothing";
+    string rtn(lex::type_name(t->type));
+    rtn += " \"" + escape(src, t->offset, t->offset + std::min<size_t>(t->length, 64)) + (t->length > 64 ? "...\"" : "\"");
+    rtn += " at " + std::to_string(t->offset) + " length " + std::to_string(t->length);
+    if (t->id >= 0 && (size_t)t->id < vocab.entries.size()) rtn += " id " + std::to_string(t->id);
+    if (t->rule >= 0 && (size_t)t->rule < vocab.rules.size()) rtn += " rule " + vocab.rules[t->rule].name;
+    return rtn;
+}
+
+// compares engine's tokens with its reference's and reports the first difference, with the
+// tokens both agreed on just before it and the source around it
+static bool compare(const lex::vocabulary_t &vocab, const string &name, std::string_view src,
+    const engine_t &engine, const diff_tokens_t &expected, const diff_tokens_t &actual)
+{
+    size_t limit = src.size();
+    if (engine.ascii)
+        for (limit = 0; limit < src.size() && src[limit] != 0 && (uint8_t)src[limit] < 0x80; ++limit);
+    auto ends = [](const diff_token_t &t) { return t.offset + t.length; };
+
+    size_t i = 0;
+    while (i < expected.size() && i < actual.size() && expected[i] == actual[i]) ++i;
+    if (i == expected.size() && i == actual.size())
+        return true;
+    if (limit < src.size() && (i == expected.size() || i == actual.size() ||
+        ends(expected[i]) > limit || ends(actual[i]) > limit))
+        return true;
+
+    const diff_token_t *want = i < expected.size() ? &expected[i] : nullptr;
+    const diff_token_t *got = i < actual.size() ? &actual[i] : nullptr;
+    const size_t offset = std::min(want ? want->offset : src.size(), got ? got->offset : src.size());
+    size_t line = 1, column = 1;
+    for (size_t j = 0; j < offset && j < src.size(); ++j, ++column)
+        if (src[j] == '\n') { ++line; column = 0; }
+
+    const size_t width = std::max({strlen(engine.name), strlen(engine.reference), strlen("source")}) + 2;
+    auto label = [&](const char *str) { return "  " + (str + ":"s).append(width - strlen(str) - 1, ' '); };
+    cerr << name << ": " << engine.name << " differs from " << engine.reference << " at token " << i
+         << ", line " << line << " column " << column << '\n';
+    for (size_t j = i > 3 ? i - 3 : 0; j < i; ++j)
+        cerr << label("both") << describe(vocab, src, &expected[j]) << '\n';
+    cerr << label(engine.reference) << describe(vocab, src, want) << '\n';
+    cerr << label(engine.name) << describe(vocab, src, got) << '\n';
+    const size_t begin = offset > 40 ? offset - 40 : 0;
+    const string before = escape(src, begin, offset);
+    cerr << label("source") << before << escape(src, offset, offset + 40) << '\n'
+         << string(width + 2 + before.size(), ' ') << "^\n";
+    return false;
+}
+
+// a vocabulary and the engines compared for it
+struct context_t
+{
+    string name; // the spec, "builtin" for the builtin vocabulary
+    vocab_ptr_t vocab;
+    vector<engine_t> engines;
+};
+
+// runs src through every engine, false if any of them differ from their reference
+static bool check(const context_t &context, const string &name, std::string_view src)
+{
+    const vector<engine_t> &engines = context.engines;
+    vector<diff_tokens_t> tokens(engines.size());
+    const string label = name + " (" + context.name + ")";
+    bool rtn = true;
+    for (size_t i = 0; i < engines.size(); ++i)
+    {
+        const vocab_ptr_t &vocab = engines[i].vocab ? engines[i].vocab : context.vocab;
+        engines[i].lex(vocab, src, tokens[i]);
+        if (engines[i].reference == nullptr)
+            continue;
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (engines[j].name != string(engines[i].reference))
+                continue;
+            rtn = compare(*vocab, label, src, engines[i], tokens[j], tokens[i]) && rtn;
+        }
+    }
+    return rtn;
+}
+
+static bool load_vocab(const string &spec, lex::vocabulary_t &vocab)
+{
+    string error;
+    if (spec.empty())
+    {
+        lex::load_builtin(vocab);
+        if (lex::build_dfa(vocab, error))
+            return true;
+    }
+    else if (lex::load_spec(spec, true, vocab, error))
+        return true;
+    cerr << error << '\n';
+    return false;
+}
+
+// the given specs, or the builtin vocabulary and every spec in spec/
+static bool load_contexts(vector<string> specs, vector<context_t> &contexts)
+{
+    if (specs.empty())
+    {
+        specs.push_back("");
+        std::error_code ec;
+        vector<string> found;
+        for (const auto &entry : lex::fs::directory_iterator("spec", ec))
+            if (entry.path().extension() == ".lexspec") found.push_back(entry.path().generic_string());
+        std::sort(found.begin(), found.end());
+        specs.insert(specs.end(), found.begin(), found.end());
+    }
+    for (const string &spec : specs)
+    {
+        auto vocab = std::make_shared<lex::vocabulary_t>();
+        if (!load_vocab(spec, *vocab))
+            return false;
+        contexts.push_back({spec.empty() ? "builtin" : spec, vocab, engines_for(*vocab)});
+    }
+    return true;
+}
+
+#ifdef LEX_FUZZ
+// $LEX_DIFF_SPEC picks a spec instead of the builtin vocabulary and spec/, a difference aborts
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static const vector<context_t> contexts = []
+    {
+        vector<context_t> rtn;
+        const char *spec = std::getenv("LEX_DIFF_SPEC");
+        if (!load_contexts(spec ? vector<string>{spec} : vector<string>{}, rtn)) std::abort();
+        return rtn;
+    }();
+    for (const context_t &context : contexts)
+        if (!check(context, "input", std::string_view((const char *)data, size)))
+            std::abort();
+    return 0;
+}
+#else
+// generated source with a few random edits, cutting tokens and delimiters apart, splicing in
+// vocabulary entries and writing bytes that aren't valid UTF-8
+static string mutate(const lex::vocabulary_t &vocab, uint64_t seed, size_t size)
+{
+    static const vector<string> pieces = {"é", "Ω", "東", "\U0001F600", "\xC3", "\xE6\x9D", "\xFF", "\\", "\"", "'", "\n", "\0"s};
+    std::mt19937_64 rng(seed);
+    lex::corpus_options_t options;
+    options.seed = seed;
+    lex::corpus_generator_t generator(vocab, options);
+    string rtn;
+    generator.generate(rtn, rng() % (size + 1));
+    for (size_t edits = rng() % 9; edits-- > 0;)
+    {
+        const size_t pos = rtn.empty() ? 0 : rng() % rtn.size();
+        const size_t length = std::min<size_t>(rng() % 16, rtn.size() - pos);
+        switch (rng() % 6)
+        {
+            case 0: if (!rtn.empty()) rtn[pos] = (char)rng(); break;
+            case 1: if (!vocab.entries.empty()) rtn.insert(pos, vocab.entries[rng() % vocab.entries.size()]); break;
+            case 2: rtn.insert(pos, pieces[rng() % pieces.size()]); break;
+            case 3: rtn.erase(pos, length); break;
+            case 4: rtn.insert(rng() % (rtn.size() + 1), rtn.substr(pos, length)); break;
+            case 5: rtn.resize(pos); break;
+        }
+    }
+    return rtn;
+}
+
+int main(int argc, char **argv)
+{
+    string save;
+    vector<string> specs;
+    uint64_t seed = 1;
+    size_t iterations = 1000, size = 4096;
+    vector<string> paths;
+    bool ok = true;
+    for (int i = 1; i < argc && ok; ++i)
+    {
+        const bool value = i + 1 < argc;
+        if (argv[i] == "--spec"s && value) specs.push_back(argv[++i]);
+        else if (argv[i] == "--seed"s && value) seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (argv[i] == "--iterations"s && value) iterations = std::strtoull(argv[++i], nullptr, 10);
+        else if (argv[i] == "--size"s && value) size = std::strtoull(argv[++i], nullptr, 10);
+        else if (argv[i] == "--save"s && value) save = argv[++i];
+        else if (argv[i][0] != '-' || argv[i] == "-"s) paths.push_back(argv[i]);
+        else ok = false;
+    }
+    if (!ok)
+    {
+        cerr << "usage: " << argv[0] << " [--spec file]... [files...]\n"
+            "    " << argv[0] << " [--spec file]... [--seed n] [--iterations n] [--size bytes] [--save file]\n";
+        return 1;
+    }
+
+    vector<context_t> contexts;
+    if (!load_contexts(specs, contexts))
+        return 1;
+    for (const context_t &context : contexts)
+    {
+        cerr << context.name << ":";
+        for (const engine_t &engine : context.engines)
+            cerr << ' ' << engine.name << (engine.reference ? " (vs "s + engine.reference + ")" : ""s);
+        cerr << '\n';
+    }
+
+    size_t failed = 0;
+    if (!paths.empty())
+    {
+        string source;
+        for (const string &path : paths)
+        {
+            if (!lex::read_file(path, source))
+            {
+                cerr << "can't read " << path << '\n';
+                ++failed;
+                continue;
+            }
+            for (const context_t &context : contexts)
+                failed += !check(context, path, source);
+        }
+        return failed > 0 ? 1 : 0;
+    }
+
+    // every iteration has a seed of its own, so a difference is reproduced with --seed n --iterations 1
+    for (const context_t &context : contexts)
+    {
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            const string source = mutate(*context.vocab, seed + i, size);
+            const string name = "seed " + std::to_string(seed + i);
+            if (check(context, name, source))
+                continue;
+            if (!save.empty() && std::ofstream(save, std::ios::binary).write(source.data(), source.size()))
+                cerr << "saved the source to " << save << '\n';
+            return 1;
+        }
+    }
+    cerr << iterations << " sources from seed " << seed << " for each vocabulary, no differences\n";
+    return 0;
+}
+#endif
@@ -0,0 +1,266 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// lexgen writes the DFA for a spec (or the builtin vocabulary) out as a standalone
+// C++ header where every state is a label and every transition a switch case
+
+#include "lex.hpp"
+#include "dfa.hpp"
+#include "spec.hpp"
+
+using std::cout;
+using std::cerr;
+using std::ostream;
+using std::string;
+using std::vector;
+using namespace std::string_literals;
+
+static void write_char(ostream &out, char c)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    switch (c)
+    {
+        case '\'': out << "'\\''"; return;
+        case '\\': out << "'\\\\'"; return;
+        default: break;
+    }
+    if (c >= 0x20 && c < 0x7F)
+        out << '\'' << c << '\'';
+    else
+        out << "'\\x" << hex[(uint8_t)c >> 4] << hex[(uint8_t)c & 0xF] << '\'';
+}
+
+static void write_string(ostream &out, const string &str)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    out << '"';
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (c >= 0x20 && c < 0x7F) out << c;
+        else out << "\\x" << hex[(uint8_t)c >> 4] << hex[(uint8_t)c & 0xF] << "\"\"";
+    }
+    out << '"';
+}
+
+static void generate(ostream &out, const string &ns, const string &source, const lex::vocabulary_t &vocab)
+{
+    const lex::dfa_t &dfa = vocab.dfa;
+    const uint32_t nstates = (uint32_t)dfa.accept.size();
+
+    out << "// generated by lexgen from " << source << ", do not edit\n\n#pragma once\n\n"
+        << "#include <cstddef>\n#include <cstdint>\n#include <string_view>\n\n"
+        << "namespace " << ns << "\n{\n";
+
+    out << "    enum token_type { END, USER, KEYWORD, SYMBOL, STRING, COMMENT };\n"
+        << "    // id indexes entry_names for vocabulary entries and is -1 otherwise\n"
+        << "    struct token_t { token_type type; int rule; std::string_view value; int id; };\n"
+        << "    struct rule_t { token_type type; int rule; int id; const char *close; size_t close_size; char escape; };\n\n";
+
+    // the same dense ids as vocabulary_t::entries
+    out << "    static const char *const entry_names[] = {";
+    for (const string &entry : vocab.entries)
+    {
+        write_string(out, entry);
+        out << ", ";
+    }
+    out << "nullptr};\n\n";
+
+    out << "    static const char *const rule_names[] = {";
+    for (const lex::rule_t &rule : vocab.rules)
+    {
+        write_string(out, rule.name);
+        out << ", ";
+    }
+    out << "nullptr};\n\n";
+
+    out << "    static const rule_t rules[] = {\n";
+    for (const lex::dfa_rule_t &rule : dfa.rules)
+    {
+        out << "        {" << lex::type_name(rule.type) << ", " << rule.rule << ", " << rule.id << ", ";
+        write_string(out, rule.delim.close);
+        out << ", " << rule.delim.close.size() << ", ";
+        write_char(out, rule.delim.escape);
+        out << "},\n";
+    }
+    out << "    };\n\n";
+
+    // 0 SPACE, 1 WORD, 2 PUNCT, 3 UTF8
+    out << "    static const uint8_t classes[256] = {";
+    for (size_t c = 0; c < 256; ++c)
+        out << (c % 32 == 0 ? "\n        " : "") << (int)vocab.modes[0].classes.table[c] << ",";
+    out << "\n    };\n\n";
+
+    // direct coded DFA, longest match at the start of [begin, end)
+    out << "    inline int32_t match(const char *begin, const char *end, size_t &length)\n"
+        << "    {\n"
+        << "        const char *it = begin;\n"
+        << "        int32_t rtn = -1;\n"
+        << "        goto s" << dfa.start << "_next;\n";
+    vector<bool> targeted(nstates, false);
+    for (uint32_t next : dfa.next)
+        targeted[next] = true;
+    for (uint32_t s = 1; s < nstates; ++s)
+    {
+        if (targeted[s])
+            out << "    s" << s << ":\n";
+        if (dfa.accept[s] >= 0)
+            out << "        rtn = " << dfa.accept[s] << ";\n"
+                << "        length = it - begin;\n";
+        if (s == dfa.start)
+            out << "    s" << s << "_next:\n";
+
+        // group the bytes by target state
+        std::map<uint32_t, vector<int>> targets;
+        for (int c = 0; c < 256; ++c)
+            if (uint32_t next = dfa.next[s * dfa.nclasses + dfa.classmap[c]]; next != 0)
+                targets[next].push_back(c);
+        if (targets.empty())
+        {
+            out << "        return rtn;\n";
+            continue;
+        }
+        out << "        if (it == end) return rtn;\n"
+            << "        switch ((uint8_t)*it++)\n"
+            << "        {\n";
+        for (const auto &[next, bytes] : targets)
+        {
+            out << "            ";
+            for (size_t i = 0; i < bytes.size(); ++i)
+                out << (i > 0 && i % 8 == 0 ? "\n            " : "") << "case " << bytes[i] << ": ";
+            out << "goto s" << next << ";\n";
+        }
+        out << "            default: return rtn;\n"
+            << "        }\n";
+    }
+    out << "    }\n\n";
+
+    out << R"(    // length of the valid UTF-8 character at the front of src, 0 if it isn't one
+    inline size_t utf8_length(std::string_view src)
+    {
+        const uint8_t c = (uint8_t)src[0];
+        size_t length;
+        uint32_t cp, min;
+        if (c >= 0xC2 && c <= 0xDF) { length = 2; min = 0x80; cp = c & 0x1F; }
+        else if (c >= 0xE0 && c <= 0xEF) { length = 3; min = 0x800; cp = c & 0x0F; }
+        else if (c >= 0xF0 && c <= 0xF4) { length = 4; min = 0x10000; cp = c & 0x07; }
+        else return 0;
+        if (src.size() < length) return 0;
+        for (size_t i = 1; i < length; ++i)
+        {
+            if (((uint8_t)src[i] & 0xC0) != 0x80) return 0;
+            cp = (cp << 6) | ((uint8_t)src[i] & 0x3F);
+        }
+        if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return 0;
+        return length;
+    }
+
+    inline size_t find_delimited(std::string_view src, size_t pos, const rule_t &rule)
+    {
+        for (; pos < src.size(); ++pos)
+        {
+            if (src[pos] == rule.escape && rule.escape != 0)
+                ++pos;
+            else if (src.compare(pos, rule.close_size, std::string_view(rule.close, rule.close_size)) == 0)
+                return pos + rule.close_size;
+        }
+        return src.size();
+    }
+
+    // same tokens as lex::lexer_t::next_dfa for the same spec
+    inline token_t next_token(std::string_view &src)
+    {
+        for (;;)
+        {
+            size_t length = 0;
+            while (length < src.size() && classes[(uint8_t)src[length]] == 0) ++length;
+            src.remove_prefix(length);
+            if (src.empty())
+                return {END, -1, src, -1};
+
+            token_t rtn = {USER, -1, {}, -1};
+            if (int32_t m = match(src.data(), src.data() + src.size(), length); m >= 0)
+            {
+                rtn.type = rules[m].type;
+                rtn.rule = rules[m].rule;
+                rtn.id = rules[m].id;
+                if (rtn.type == STRING || rtn.type == COMMENT)
+                    length = find_delimited(src, length, rules[m]);
+            }
+            else if (classes[(uint8_t)src[0]] == 3)
+            {
+                // a single UTF-8 character that isn't part of an identifier
+                length = utf8_length(src);
+                if (length == 0) length = 1;
+            }
+            else
+            {
+                for (length = 1; length < src.size() && classes[(uint8_t)src[length]] == 2; ++length);
+            }
+
+            rtn.value = src.substr(0, length);
+            src.remove_prefix(length);
+            if (rtn.type != COMMENT)
+                return rtn;
+        }
+    }
+}
+)";
+}
+
+int main(int argc, char **argv)
+{
+    string spec;
+    string ns = "scanner";
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i] == "--spec"s && i + 1 < argc) spec = argv[++i];
+        else if (argv[i] == "--namespace"s && i + 1 < argc) ns = argv[++i];
+        else
+        {
+            cerr << "usage: " << argv[0] << " [--spec file] [--namespace name] > scanner.hpp\n";
+            return 1;
+        }
+    }
+
+    string error;
+    lex::vocabulary_t vocab;
+    if (spec.empty())
+    {
+        lex::load_builtin(vocab);
+        if (!lex::build_dfa(vocab, error))
+        {
+            cerr << error << '\n';
+            return 1;
+        }
+    }
+    else if (!lex::load_spec(spec, false, vocab, error))
+    {
+        cerr << error << '\n';
+        return 1;
+    }
+
+    generate(cout, ns, spec.empty() ? "the builtin vocabulary" : spec, vocab);
+    return cout.good() ? 0 : 1;
+}
@@ -0,0 +1,524 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_SPEC_HPP
+#define LEX_SPEC_HPP
+
+#include "lex.hpp"
+#include "dfa.hpp"
+
+#include <map>
+#include <sstream>
+#include <filesystem>
+#include <random>
+
+namespace lex
+{
+    namespace fs = std::filesystem;
+
+    // a parsed but not yet compiled lexer spec file
+    struct spec_t
+    {
+        struct delimited_t { string open, close; char escape; };
+        // lexing str pushes mode, or pops the current mode if mode is empty
+        struct action_t { string str, mode; };
+        struct mode_spec_t
+        {
+            string name = "main";
+            vector<string> keywords;
+            vector<string> symbols;
+            vector<delimited_t> comments;
+            vector<delimited_t> strings;
+            string word; // bytes in the WORD class, defaults to alphanumerics
+            string space; // bytes in the SPACE class, defaults to isspace
+            vector<action_t> actions;
+        };
+        vector<mode_spec_t> modes = vector<mode_spec_t>(1); // directives before the first mode line go to main
+        vector<rule_t> rules;
+    };
+
+    static inline bool unescape(const string &str, string &rtn)
+    {
+        rtn.clear();
+        for (size_t i = 0; i < str.size(); ++i)
+        {
+            if (str[i] != '\\' || i + 1 == str.size())
+            {
+                rtn += str[i];
+                continue;
+            }
+            switch (str[++i])
+            {
+                case 'n': rtn += '\n'; break;
+                case 'r': rtn += '\r'; break;
+                case 't': rtn += '\t'; break;
+                case 'v': rtn += '\v'; break;
+                case 'f': rtn += '\f'; break;
+                case 's': rtn += ' '; break;
+                case '0': rtn += '\0'; break;
+                case 'x':
+                {
+                    if (i + 2 >= str.size() || !is_hex(str[i+1]) || !is_hex(str[i+2]))
+                        return false;
+                    rtn += (char)std::stoi(str.substr(i + 1, 2), nullptr, 16);
+                    i += 2;
+                } break;
+                default: rtn += str[i]; break;
+            }
+        }
+        return true;
+    }
+
+    // "a-z" style ranges or single bytes
+    static inline bool expand_range(const string &str, string &bytes)
+    {
+        if (str.size() == 3 && str[1] == '-')
+        {
+            if ((uint8_t)str[0] > (uint8_t)str[2]) return false;
+            for (int c = (uint8_t)str[0]; c <= (uint8_t)str[2]; ++c)
+                bytes += (char)c;
+            return true;
+        }
+        if (str.size() != 1) return false;
+        bytes += str;
+        return true;
+    }
+
+    static inline bool parse_spec(const string &text, spec_t &spec, string &error)
+    {
+        std::istringstream strm(text);
+        string line;
+        size_t current = 0;
+        for (size_t lineno = 1; std::getline(strm, line); ++lineno)
+        {
+            std::istringstream words(line);
+            string directive;
+            if (!(words >> directive) || directive[0] == '#') continue;
+
+            if (directive == "mode")
+            {
+                // mode <name>, the directives that follow belong to it
+                string name, rest;
+                if (!(words >> name) || words >> rest)
+                {
+                    error = "line " + std::to_string(lineno) + ": expected mode <name>";
+                    return false;
+                }
+                for (current = 0; current < spec.modes.size() && spec.modes[current].name != name; ++current);
+                if (current == spec.modes.size())
+                {
+                    spec.modes.emplace_back();
+                    spec.modes.back().name = name;
+                }
+                continue;
+            }
+
+            if (directive == "rule")
+            {
+                if (current != 0)
+                {
+                    error = "line " + std::to_string(lineno) + ": rules are only supported in the main mode";
+                    return false;
+                }
+                // rule <name> <regex>, the regex is the rest of the line
+                rule_t rule;
+                regex_t regex;
+                words >> rule.name >> std::ws;
+                std::getline(words, rule.regex);
+                while (rule.regex.size() > 0 && is_space(rule.regex.back()))
+                    rule.regex.pop_back();
+                if (rule.name.empty() || rule.regex.empty())
+                {
+                    error = "line " + std::to_string(lineno) + ": expected rule <name> <regex>";
+                    return false;
+                }
+                if (!parse_regex(rule.regex, regex, error))
+                {
+                    error = "line " + std::to_string(lineno) + ": " + error;
+                    return false;
+                }
+                spec.rules.push_back(rule);
+                continue;
+            }
+
+            vector<string> args;
+            for (string word, arg; words >> word; args.push_back(arg))
+            {
+                if (!unescape(word, arg) || arg.empty())
+                {
+                    error = "line " + std::to_string(lineno) + ": bad escape in \"" + word + "\"";
+                    return false;
+                }
+            }
+
+            bool ok = true;
+            spec_t::mode_spec_t &mode = spec.modes[current];
+            if (directive == "keyword")
+                mode.keywords.insert(mode.keywords.end(), args.begin(), args.end());
+            else if (directive == "symbol")
+                mode.symbols.insert(mode.symbols.end(), args.begin(), args.end());
+            else if (directive == "push")
+            {
+                // push <mode> <str>...
+                ok = args.size() >= 2;
+                for (size_t i = 1; ok && i < args.size(); ++i)
+                    mode.actions.push_back({args[i], args[0]});
+            }
+            else if (directive == "pop")
+            {
+                for (const string &arg : args)
+                    mode.actions.push_back({arg, ""});
+            }
+            else if (directive == "word" || directive == "space")
+            {
+                string &bytes = directive == "word" ? mode.word : mode.space;
+                for (const string &arg : args)
+                    ok = ok && expand_range(arg, bytes);
+            }
+            else if (directive == "comment")
+            {
+                // comment <open> [close], close defaults to end of line
+                ok = args.size() == 1 || args.size() == 2;
+                if (ok) mode.comments.push_back({args[0], args.size() > 1 ? args[1] : "\n", 0});
+            }
+            else if (directive == "string")
+            {
+                // string <open> [close] [escape], close defaults to open
+                ok = args.size() >= 1 && args.size() <= 3 && (args.size() < 3 || args[2].size() == 1);
+                if (ok) mode.strings.push_back({args[0], args.size() > 1 ? args[1] : args[0], args.size() > 2 ? args[2][0] : (char)0});
+            }
+            else
+            {
+                error = "line " + std::to_string(lineno) + ": unknown directive \"" + directive + "\"";
+                return false;
+            }
+
+            if (!ok)
+            {
+                error = "line " + std::to_string(lineno) + ": bad arguments to \"" + directive + "\"";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static inline bool compile(const spec_t::mode_spec_t &spec, const vector<spec_t::mode_spec_t> &names,
+        size_t index, vocabulary_t &vocab, string &error)
+    {
+        mode_t &mode = vocab.modes[index];
+        mode.name = spec.name;
+        mode.classes.reset();
+        for (char_class &c : mode.classes.table)
+        {
+            if ((c == WORD && spec.word.size() > 0) || (c == SPACE && spec.space.size() > 0))
+                c = PUNCT;
+        }
+        for (char c : spec.space) mode.classes[c] = SPACE;
+        for (char c : spec.word) mode.classes[c] = WORD;
+
+        for (const string &str : spec.symbols)
+            vocab.add_entry(index, str, {token_type::SYMBOL});
+        for (const string &str : spec.keywords)
+            vocab.add_entry(index, str, {token_type::KEYWORD});
+        for (const auto &delim : spec.comments)
+        {
+            vocab.add_entry(index, delim.open, {token_type::COMMENT});
+            mode.delimiters[delim.open] = {delim.close, delim.escape};
+        }
+        for (const auto &delim : spec.strings)
+        {
+            vocab.add_entry(index, delim.open, {token_type::STRING});
+            mode.delimiters[delim.open] = {delim.close, delim.escape};
+        }
+
+        // push and pop entries keep their type if they were declared, otherwise they're symbols
+        for (const auto &action : spec.actions)
+        {
+            const auto *node = mode.tokens.find(action.str);
+            entry_t entry = node != nullptr && node->values.size() > 0 ? node->values[0] : entry_t{token_type::SYMBOL};
+            if (action.mode.empty())
+                entry.pop = true;
+            else
+            {
+                size_t push = 0;
+                for (; push < names.size() && names[push].name != action.mode; ++push);
+                if (push == names.size())
+                {
+                    error = "mode " + spec.name + ": push to unknown mode \"" + action.mode + "\"";
+                    return false;
+                }
+                entry.push = (int16_t)push;
+            }
+            vocab.add_entry(index, action.str, entry);
+        }
+        return true;
+    }
+
+    static inline bool compile(const spec_t &spec, vocabulary_t &vocab, string &error)
+    {
+        vocab = vocabulary_t();
+        vocab.modes.resize(spec.modes.size());
+        for (size_t i = 0; i < spec.modes.size(); ++i)
+            if (!compile(spec.modes[i], spec.modes, i, vocab, error))
+                return false;
+
+        vocab.rules = spec.rules;
+        return build_dfa(vocab, error);
+    }
+
+    // the vocabulary used when no spec is given, without its DFA
+    static inline void load_builtin(vocabulary_t &vocab)
+    {
+        vector<string> symbols = {
+            "~","~=","`","!","!=","@","#","$","%","%=","^","^=","&","&=","&&","*","*=","-","-=","+","+=","=",
+            "(",")","[","}","[","]","|","|=","||",":",";","<","<=",">",">=","==",",",".","?","/","'","->","\"","\\"
+        };
+        for (const string &str : symbols)
+            vocab.add_entry(0, str, {token_type::SYMBOL});
+        vector<string> keywords = {
+            "for", "while", "if", "switch", "case", "default", "break", "const", "constexpr", "return",
+            "friend", "public", "private", "protected", "struct", "enum", "union", "class"
+        };
+        for (const string &str : keywords)
+            vocab.add_entry(0, str, {token_type::KEYWORD});
+    }
+
+    // bump whenever the compiled table layout changes
+    static const uint32_t cache_version = 6;
+    static const char cache_magic[4] = {'L', 'E', 'X', 'C'};
+
+    static inline bool save_tables(const fs::path &path, const vocabulary_t &vocab)
+    {
+        // write to a temporary and rename so concurrent runs never see a partial cache
+        fs::path temp = path;
+        temp += ".tmp" + std::to_string(std::random_device{}());
+        {
+            std::ofstream strm(temp, std::ios::binary | std::ios::trunc);
+            if (!strm.is_open()) return false;
+            strm.write(cache_magic, sizeof(cache_magic));
+            lak::write_pod(strm, cache_version);
+            lak::write_pod(strm, (uint32_t)vocab.modes.size());
+            for (const mode_t &mode : vocab.modes)
+            {
+                lak::write_string(strm, mode.name);
+                strm.write((const char *)mode.classes.table, sizeof(mode.classes.table));
+                mode.tokens.write(strm, write_entry);
+                lak::write_pod(strm, (uint32_t)mode.delimiters.size());
+                for (const auto &[open, delim] : mode.delimiters)
+                {
+                    lak::write_string(strm, open);
+                    lak::write_string(strm, delim.close);
+                    lak::write_pod(strm, delim.escape);
+                }
+            }
+            lak::write_pod(strm, (uint32_t)vocab.rules.size());
+            for (const rule_t &rule : vocab.rules)
+            {
+                lak::write_string(strm, rule.name);
+                lak::write_string(strm, rule.regex);
+            }
+            vocab.dfa.write(strm);
+            if (!strm.good()) return false;
+        }
+        std::error_code ec;
+        fs::rename(temp, path, ec);
+        if (ec) fs::remove(temp, ec);
+        return !ec;
+    }
+
+    static inline bool load_tables(const fs::path &path, vocabulary_t &vocab)
+    {
+        std::ifstream strm(path, std::ios::binary);
+        char magic[sizeof(cache_magic)];
+        uint32_t version = 0;
+        if (!strm.read(magic, sizeof(magic)) || std::memcmp(magic, cache_magic, sizeof(magic)) != 0 ||
+            !lak::read_pod(strm, version) || version != cache_version)
+            return false;
+
+        vector<mode_t> mode_list;
+        vector<rule_t> rule_list;
+        dfa_t table_dfa;
+        uint32_t count = 0;
+        if (!lak::read_pod(strm, count) || count == 0) return false;
+        mode_list.resize(count);
+        for (mode_t &mode : mode_list)
+        {
+            if (!lak::read_string(strm, mode.name) || !strm.read((char *)mode.classes.table, sizeof(mode.classes.table)) ||
+                !mode.tokens.read(strm, read_entry) || !lak::read_pod(strm, count))
+                return false;
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                string open;
+                delimiter_t delim;
+                if (!lak::read_string(strm, open) || !lak::read_string(strm, delim.close) || !lak::read_pod(strm, delim.escape))
+                    return false;
+                mode.delimiters[open] = delim;
+            }
+        }
+        if (!lak::read_pod(strm, count)) return false;
+        rule_list.resize(count);
+        for (rule_t &rule : rule_list)
+            if (!lak::read_string(strm, rule.name) || !lak::read_string(strm, rule.regex))
+                return false;
+        if (!table_dfa.read(strm)) return false;
+
+        // a corrupt cache must not reach the lexer, every push has to name a mode and the ids
+        // have to be dense over the entries before they size the id table. read_entry and
+        // dfa_t::read have already checked everything that doesn't need the rest of the cache
+        std::unordered_map<string, int32_t> ids;
+        bool valid = true;
+        for (const mode_t &mode : mode_list)
+        {
+            mode.tokens.each([&](const string &str, const vector<entry_t> &values)
+            {
+                for (const entry_t &entry : values)
+                    valid = valid && entry.push < (int32_t)mode_list.size();
+                if (valid && !values.empty() && values[0].id >= 0)
+                    valid = ids.emplace(str, values[0].id).first->second == values[0].id;
+            });
+        }
+        for (const auto &[str, id] : ids)
+            valid = valid && (size_t)id < ids.size();
+        for (const dfa_rule_t &rule : table_dfa.rules)
+            valid = valid && rule.rule < (int)rule_list.size() && rule.id < (int)ids.size();
+        if (!valid) return false;
+
+        vocab = vocabulary_t();
+        vocab.modes = std::move(mode_list);
+        vocab.rules = std::move(rule_list);
+        vocab.dfa = std::move(table_dfa);
+
+        // the ids are stored with the entries, rebuild the id to text table from them
+        for (const mode_t &mode : vocab.modes)
+        {
+            mode.tokens.each([&](const string &str, const vector<entry_t> &values)
+            {
+                if (values[0].id < 0) return;
+                if ((size_t)values[0].id >= vocab.entries.size()) vocab.entries.resize(values[0].id + 1);
+                vocab.entries[values[0].id] = str;
+                vocab.entry_ids[str] = values[0].id;
+            });
+        }
+        return true;
+    }
+
+    // hash of everything in vocab that changes the tokens it lexes, the same for a vocabulary
+    // however it was built. tries and delimiters are sorted first since their order isn't stable
+    static inline uint64_t vocabulary_hash(const vocabulary_t &vocab)
+    {
+        std::ostringstream strm;
+        lak::write_pod(strm, cache_version);
+        for (const mode_t &mode : vocab.modes)
+        {
+            lak::write_string(strm, mode.name);
+            strm.write((const char *)mode.classes.table, sizeof(mode.classes.table));
+            vector<std::pair<string, entry_t>> tokens;
+            mode.tokens.each([&](const string &str, const vector<entry_t> &values) { tokens.emplace_back(str, values[0]); });
+            std::sort(tokens.begin(), tokens.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+            for (const auto &[str, entry] : tokens)
+            {
+                lak::write_string(strm, str);
+                lak::write_pod(strm, (int32_t)entry.type);
+                lak::write_pod(strm, entry.id);
+                lak::write_pod(strm, entry.push);
+                lak::write_pod(strm, entry.pop);
+            }
+            std::map<string, delimiter_t> delimiters(mode.delimiters.begin(), mode.delimiters.end());
+            for (const auto &[open, delim] : delimiters)
+            {
+                lak::write_string(strm, open);
+                lak::write_string(strm, delim.close);
+                lak::write_pod(strm, delim.escape);
+            }
+        }
+        for (const rule_t &rule : vocab.rules)
+        {
+            lak::write_string(strm, rule.name);
+            lak::write_string(strm, rule.regex);
+        }
+        const string data = strm.str();
+        return lak::hash64(data.data(), data.size());
+    }
+
+    // $LEX_CACHE_DIR, $XDG_CACHE_HOME/lex or ~/.cache/lex, empty if none of them are set
+    static inline fs::path cache_dir()
+    {
+        if (const char *dir = std::getenv("LEX_CACHE_DIR"); dir != nullptr && *dir)
+            return dir;
+        if (const char *dir = std::getenv("XDG_CACHE_HOME"); dir != nullptr && *dir)
+            return fs::path(dir) / "lex";
+        if (const char *dir = std::getenv("HOME"); dir != nullptr && *dir)
+            return fs::path(dir) / ".cache" / "lex";
+        return {};
+    }
+
+    // loads the spec at path into vocab, using the on disk cache when possible
+    static inline bool load_spec(const fs::path &path, bool use_cache, vocabulary_t &vocab, string &error)
+    {
+        std::ifstream strm(path, std::ios::binary);
+        if (!strm.is_open())
+        {
+            error = "failed to open spec " + path.string();
+            return false;
+        }
+        std::ostringstream text;
+        text << strm.rdbuf();
+        const string spec_text = text.str();
+
+        fs::path cache_path;
+        if (fs::path dir = cache_dir(); use_cache && !dir.empty())
+        {
+            uint64_t hash = lak::fnv1a((const char *)&cache_version, sizeof(cache_version));
+            hash = lak::fnv1a(spec_text.data(), spec_text.size(), hash);
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.lexc", (unsigned long long)hash);
+            cache_path = dir / name;
+            if (load_tables(cache_path, vocab))
+                return true;
+        }
+
+        spec_t spec;
+        if (!parse_spec(spec_text, spec, error))
+        {
+            error = path.string() + ": " + error;
+            return false;
+        }
+        if (!compile(spec, vocab, error))
+        {
+            error = path.string() + ": " + error;
+            return false;
+        }
+
+        if (!cache_path.empty())
+        {
+            // a failed cache write only costs us the next startup
+            std::error_code ec;
+            fs::create_directories(cache_path.parent_path(), ec);
+            save_tables(cache_path, vocab);
+        }
+        return true;
+    }
+}
+
+#endif
@@ -0,0 +1,135 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_STATS_HPP
+#define LEX_STATS_HPP
+
+#include "lex.hpp"
+
+namespace lak
+{
+    // copies of strings that live as long as the arena, in large blocks so there's no
+    // allocation per string
+    struct string_arena_t
+    {
+        vector<std::unique_ptr<char[]>> blocks;
+        size_t used = 0;
+        size_t capacity = 0;
+
+        std::string_view copy(std::string_view str)
+        {
+            if (blocks.empty() || str.size() > capacity - used)
+            {
+                // strings bigger than a block get one of their own
+                capacity = std::max<size_t>(str.size(), 1 << 16);
+                blocks.emplace_back(new char[capacity]);
+                lex::count(lex::COUNT_ALLOCATIONS);
+                used = 0;
+            }
+            char *rtn = blocks.back().get() + used;
+            std::memcpy(rtn, str.data(), str.size());
+            used += str.size();
+            return {rtn, str.size()};
+        }
+    };
+}
+
+namespace lex
+{
+    // token counts by kind, vocabulary entry and identifier. one per thread, merged at the end
+    struct token_stats_t
+    {
+        uint64_t files = 0;
+        uint64_t bytes = 0;
+        uint64_t tokens = 0;
+        uint64_t types[6] = {}; // tokens that didn't match a rule, by token_type
+        vector<uint64_t> rules;   // by index into vocabulary_t::rules
+        vector<uint64_t> entries; // by entry id
+        unordered_map<std::string_view, uint64_t> identifiers; // identifiers that aren't entries, keys in names
+        lak::string_arena_t names;
+        const class_table_t *classes = nullptr; // the main mode's, what identifiers are made of
+
+        token_stats_t() {}
+        token_stats_t(const vocabulary_t &vocab) : classes(&vocab.modes[0].classes) {}
+
+        inline void add(token_type type, int rule, int id, std::string_view value)
+        {
+            ++tokens;
+            if (rule >= 0)
+            {
+                if ((size_t)rule >= rules.size()) rules.resize(rule + 1);
+                ++rules[rule];
+            }
+            else
+                ++types[type];
+            if (id >= 0)
+            {
+                if ((size_t)id >= entries.size()) entries.resize(id + 1);
+                ++entries[id];
+            }
+            else if (type == token_type::USER && is_identifier(value))
+                add_identifier(value, 1);
+        }
+
+        // USER tokens are words, rule matches like numbers, and runs of punctuation or characters
+        // that nothing matched. identifiers are the ones the lexer would scan as a whole word
+        // (XID for UTF-8) that don't start with a digit, whichever rule matched them
+        inline bool is_identifier(std::string_view value) const
+        {
+            if (classes == nullptr || value.empty() || (value[0] >= '0' && value[0] <= '9'))
+                return false;
+            const size_t start = identifier_start(value, *classes);
+            return start > 0 && scan_identifier(value, start, *classes) == value.size();
+        }
+
+        inline void add(const token_view_t &token) { add(token.type, token.rule, token.id, token.value); }
+
+        inline void add_identifier(std::string_view value, uint64_t count)
+        {
+            if (auto it = identifiers.find(value); it != identifiers.end())
+                it->second += count;
+            else
+                identifiers.emplace(names.copy(value), count);
+        }
+
+        void merge(const token_stats_t &other)
+        {
+            files += other.files;
+            bytes += other.bytes;
+            tokens += other.tokens;
+            for (size_t i = 0; i < 6; ++i)
+                types[i] += other.types[i];
+            if (rules.size() < other.rules.size()) rules.resize(other.rules.size());
+            for (size_t i = 0; i < other.rules.size(); ++i)
+                rules[i] += other.rules[i];
+            if (entries.size() < other.entries.size()) entries.resize(other.entries.size());
+            for (size_t i = 0; i < other.entries.size(); ++i)
+                entries[i] += other.entries[i];
+            for (const auto &[value, count] : other.identifiers)
+                add_identifier(value, count);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,190 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_TOKEN_CACHE_HPP
+#define LEX_TOKEN_CACHE_HPP
+
+#include "lex.hpp"
+#include "spec.hpp"
+#include "binary.hpp"
+
+#include <atomic>
+#include <chrono>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#endif
+
+namespace lex
+{
+    // binary token streams on disk keyed by a hash of the source and what it was lexed with, so
+    // unchanged files are never lexed twice. entries are written to a temporary and renamed into
+    // place so any number of processes can share a directory, and the least recently used are
+    // evicted when the directory grows past max_size bytes
+    struct token_cache_t
+    {
+        fs::path dir;
+        uint64_t max_size;
+        uint64_t seed; // vocabulary, engine and format version
+        // the size of the entries as of the last scan plus what was stored since, so the
+        // directory is only scanned when it may have grown past max_size. entries other
+        // processes store are only seen by a scan, so until one of them scans the directory can
+        // go over by what they stored
+        static constexpr uint64_t unknown = UINT64_MAX;
+        mutable std::atomic<uint64_t> estimate{unknown};
+
+        token_cache_t(const fs::path &directory, uint64_t max_bytes, const vocabulary_t &vocab, std::string_view engine)
+        : dir(directory), max_size(max_bytes)
+        {
+            seed = lak::hash64(engine.data(), engine.size(), vocabulary_hash(vocab) ^ binary_version);
+        }
+
+        fs::path path(std::string_view source) const
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%016llx.lext", (unsigned long long)lak::hash64(source.data(), source.size(), seed));
+            return dir / name;
+        }
+
+        // maps the entry for source into file and checks it, false on a miss
+        bool find(std::string_view source, lak::mapped_file_t &file, binary_file_t &section) const
+        {
+            const fs::path entry = path(source);
+            if (!file.open(entry.string()))
+            {
+                count(COUNT_CACHE_MISSES);
+                return false;
+            }
+            binary_reader_t reader(file.view());
+            string error;
+            // the name is a 64 bit hash, so a second independently seeded one has to match too
+            if (!reader.next(section, error) || section.header.source_size != source.size() ||
+                section.header.source_hash != lak::hash64(source.data(), source.size(), binary_source_seed) || !section.verify())
+            {
+                // corrupt or a hash collision, either way it gets replaced
+                file.close();
+                std::error_code ec;
+                fs::remove(entry, ec);
+                count(COUNT_CACHE_MISSES);
+                return false;
+            }
+            // the modified time is the last use for eviction
+            std::error_code ec;
+            fs::last_write_time(entry, fs::file_time_type::clock::now(), ec);
+            count(COUNT_CACHE_HITS);
+            return true;
+        }
+
+        // writes the tokens in encoder as the entry for its source and maps it into file
+        bool store(binary_encoder_t &encoder, lak::mapped_file_t &file, binary_file_t &section) const
+        {
+            std::error_code ec;
+            fs::create_directories(dir, ec);
+            const fs::path entry = path(encoder.source);
+            fs::path temp = entry;
+            temp += ".tmp" + std::to_string(std::random_device{}());
+#ifdef _WIN32
+            const int fd = _open(temp.string().c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+            const int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+#endif
+            if (fd < 0) return false;
+            bool written;
+            {
+                // entries are shared between files with the same contents so they don't keep a name
+                string name;
+                name.swap(encoder.name);
+                writer_t out(fd);
+                string error;
+                written = encoder.finish(out, error) && out.flush();
+                encoder.name.swap(name);
+            }
+#ifdef _WIN32
+            written = _close(fd) == 0 && written;
+#else
+            written = ::close(fd) == 0 && written;
+#endif
+            if (written)
+                fs::rename(temp, entry, ec);
+            if (!written || ec)
+            {
+                fs::remove(temp, ec);
+                return false;
+            }
+            if (!file.open(entry.string())) return false;
+            const uint64_t size = file.view().size();
+            if (estimate.load() == unknown || estimate.fetch_add(size) + size > max_size)
+                evict();
+
+            binary_reader_t reader(file.view());
+            string error;
+            return reader.next(section, error);
+        }
+
+        // removes the least recently used entries once the cache is over max_size, along with
+        // temporaries left by processes that died mid write
+        void evict() const
+        {
+            struct entry_t { fs::file_time_type time; uint64_t size; fs::path path; };
+            vector<entry_t> entries;
+            uint64_t total = 0;
+            std::error_code ec;
+            const auto stale = fs::file_time_type::clock::now() - std::chrono::hours(1);
+            for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+            {
+                const fs::path &file = it->path();
+                const auto time = it->last_write_time(ec);
+                const uint64_t size = it->file_size(ec);
+                if (ec) continue;
+                if (file.extension() == ".lext")
+                {
+                    entries.push_back({time, size, file});
+                    total += size;
+                }
+                else if (file.filename().string().find(".lext.tmp") != string::npos && time < stale)
+                    fs::remove(file, ec);
+            }
+            if (total <= max_size)
+            {
+                estimate = total;
+                return;
+            }
+            std::sort(entries.begin(), entries.end(), [](const entry_t &a, const entry_t &b) { return a.time < b.time; });
+            // down to 90% so a full cache isn't scanned again on the next store
+            const uint64_t target = max_size - max_size / 10;
+            for (const entry_t &entry : entries)
+            {
+                if (total <= target) break;
+                // whoever has it mapped keeps their view, and another process may have removed it already
+                fs::remove(entry.path, ec);
+                total -= entry.size;
+            }
+            estimate = total;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,343 @@
+/*
+MIT License
+
+Copyright (c) 2018 Lucas Kleiss (LAK132)
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef LEX_WRITER_HPP
+#define LEX_WRITER_HPP
+
+#include "lex.hpp"
+#include "input.hpp"
+
+#include <cerrno>
+#include <charconv>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(LEX_SSE2)
+#include <immintrin.h>
+#define LEX_SSE2 1
+#endif
+
+namespace lex
+{
+    // formats output into one reusable buffer and hands it to the OS in large blocks, values
+    // too big to be worth copying are written straight from the source next to the buffer.
+    // a writer made with a string appends to it instead, for output that's put in order later
+    struct writer_t
+    {
+        int fd;
+        string *sink = nullptr;
+        vector<char> buffer;
+        size_t used = 0;
+        bool failed = false; // a write failed, everything after it is dropped
+
+        writer_t(int file, size_t capacity = 1 << 18) : fd(file), buffer(capacity) { count(COUNT_ALLOCATIONS); }
+        writer_t(string &str, size_t capacity = 1 << 16) : fd(-1), sink(&str), buffer(capacity) { count(COUNT_ALLOCATIONS); }
+        writer_t(const writer_t &) = delete;
+        writer_t &operator=(const writer_t &) = delete;
+        ~writer_t() { flush(); }
+
+        // writes every byte of data, retrying short writes and interrupts
+        inline bool write_all(const char *data, size_t size)
+        {
+            if (sink != nullptr)
+            {
+                sink->append(data, size);
+                return true;
+            }
+            while (size > 0 && !failed)
+            {
+#ifdef _WIN32
+                const long long n = _write(fd, data, (unsigned)std::min<size_t>(size, 1 << 30));
+#else
+                const ssize_t n = ::write(fd, data, size);
+#endif
+                count(COUNT_WRITES);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) failed = true;
+                else
+                {
+                    count(COUNT_WRITE_BYTES, n);
+                    data += n;
+                    size -= n;
+                }
+            }
+            return !failed;
+        }
+
+        // the buffer then data in as few system calls as possible
+        inline bool write_with(const char *data, size_t size)
+        {
+#ifndef _WIN32
+            while (used > 0 && !failed && sink == nullptr)
+            {
+                iovec iov[2] = {{buffer.data(), used}, {(void *)data, size}};
+                const ssize_t n = ::writev(fd, iov, 2);
+                count(COUNT_WRITES);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0)
+                {
+                    failed = true;
+                    break;
+                }
+                count(COUNT_WRITE_BYTES, n);
+                if ((size_t)n < used)
+                {
+                    // short write, move what's left of the buffer down and go again
+                    std::memmove(buffer.data(), buffer.data() + n, used - n);
+                    used -= n;
+                    continue;
+                }
+                data += n - used;
+                size -= n - used;
+                used = 0;
+            }
+#endif
+            return flush() && write_all(data, size);
+        }
+
+        inline bool flush()
+        {
+            const bool rtn = write_all(buffer.data(), used);
+            used = 0;
+            return rtn;
+        }
+
+        inline void write(const char *data, size_t size)
+        {
+            if (size <= buffer.size() - used)
+            {
+                std::memcpy(buffer.data() + used, data, size);
+                used += size;
+            }
+            else if (size >= buffer.size() / 2)
+                write_with(data, size);
+            else
+            {
+                flush();
+                std::memcpy(buffer.data(), data, size);
+                used = size;
+            }
+        }
+
+        inline void write(std::string_view str) { write(str.data(), str.size()); }
+
+        inline void put(char c)
+        {
+            if (used == buffer.size()) flush();
+            buffer[used++] = c;
+        }
+    };
+
+    // the text format, "NAME: value\n" where NAME is the rule that matched or the token type
+    static inline void write_token(writer_t &out, std::string_view name, std::string_view value)
+    {
+        if (const size_t size = name.size() + value.size() + 3; size <= out.buffer.size() - out.used)
+        {
+            // the whole line fits, skip the per piece checks
+            char *it = out.buffer.data() + out.used;
+            std::memcpy(it, name.data(), name.size());
+            it += name.size();
+            *it++ = ':';
+            *it++ = ' ';
+            std::memcpy(it, value.data(), value.size());
+            it[value.size()] = '\n';
+            out.used += size;
+            return;
+        }
+        out.write(name);
+        out.write(": ", 2);
+        out.write(value);
+        out.put('\n');
+    }
+
+    static inline void write_token(writer_t &out, const vocabulary_t &vocab, token_type type, int rule, std::string_view value)
+    {
+        write_token(out, rule >= 0 ? std::string_view(vocab.rules[rule].name) : type_name(type), value);
+    }
+
+    static inline void write_token(writer_t &out, const vocabulary_t &vocab, const token_view_t &token)
+    {
+        write_token(out, vocab, token.type, token.rule, token.value);
+    }
+
+    // position of the first byte at or after pos that JSON needs escaped, a control character,
+    // '"' or '\\', or str.size() if there isn't one. bytes over 0x7F are valid UTF-8 and pass through
+    static inline size_t json_escape_find(std::string_view str, size_t pos = 0)
+    {
+#ifdef LEX_SSE2
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i slash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        for (; pos + 16 <= str.size(); pos += 16)
+        {
+            const __m128i input = _mm_loadu_si128((const __m128i *)(str.data() + pos));
+            const __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(input, quote), _mm_cmpeq_epi8(input, slash)),
+                _mm_cmpeq_epi8(_mm_max_epu8(input, control), control));
+            if (unsigned mask = (unsigned)_mm_movemask_epi8(special); mask != 0)
+            {
+#ifdef __GNUC__
+                return pos + __builtin_ctz(mask);
+#else
+                while ((mask & 1) == 0) { mask >>= 1; ++pos; }
+                return pos;
+#endif
+            }
+        }
+#endif
+        for (; pos < str.size(); ++pos)
+        {
+            const uint8_t c = (uint8_t)str[pos];
+            if (c < 0x20 || c == '"' || c == '\\')
+                return pos;
+        }
+        return str.size();
+    }
+
+    static const char json_hex[] = "0123456789abcdef";
+
+    // str escaped for inside a JSON string at it, runs that need no escaping are copied whole.
+    // it needs room for str.size() * 6 bytes, returns the end of what was written
+    static inline char *json_escaped(char *it, std::string_view str)
+    {
+        for (size_t pos = 0;;)
+        {
+            const size_t next = json_escape_find(str, pos);
+            std::memcpy(it, str.data() + pos, next - pos);
+            it += next - pos;
+            if (next == str.size())
+                break;
+            const char c = str[next];
+            *it++ = '\\';
+            switch (c)
+            {
+                case '"': *it++ = '"'; break;
+                case '\\': *it++ = '\\'; break;
+                case '\n': *it++ = 'n'; break;
+                case '\r': *it++ = 'r'; break;
+                case '\t': *it++ = 't'; break;
+                default:
+                    std::memcpy(it, "u00", 3);
+                    it[3] = json_hex[(uint8_t)c >> 4];
+                    it[4] = json_hex[c & 0xF];
+                    it += 5;
+                    break;
+            }
+            pos = next + 1;
+        }
+        return it;
+    }
+
+    // str as a quoted JSON string at it. it needs room for 2 + str.size() * 6 bytes, returns the
+    // end of what was written
+    static inline char *json_string(char *it, std::string_view str)
+    {
+        *it++ = '"';
+        it = json_escaped(it, str);
+        *it++ = '"';
+        return it;
+    }
+
+    // json_string for text that may not be UTF-8, like file names. token text has been through
+    // decode_input but these haven't. a byte that doesn't start a valid UTF-8 character is
+    // written as \u00XX, its latin-1 reading, so the JSON stays valid
+    static inline char *json_bytes(char *it, std::string_view str)
+    {
+        *it++ = '"';
+        for (size_t pos = 0;;)
+        {
+            const size_t bad = validate_utf8(str.substr(pos));
+            it = json_escaped(it, str.substr(pos, bad));
+            if (bad == std::string_view::npos)
+                break;
+            const uint8_t c = (uint8_t)str[pos + bad];
+            std::memcpy(it, "\\u00", 4);
+            it[4] = json_hex[c >> 4];
+            it[5] = json_hex[c & 0xF];
+            it += 6;
+            pos += bad + 1;
+        }
+        *it++ = '"';
+        return it;
+    }
+
+    static inline char *json_literal(char *it, std::string_view str)
+    {
+        std::memcpy(it, str.data(), str.size());
+        return it + str.size();
+    }
+
+    // one JSON object, {"kind":"NAME","offset":0,"length":0,"id":0,"text":"value"}. id is left out
+    // for tokens that aren't vocabulary entries and text when with_text is false
+    static inline void write_json_token(writer_t &out, std::string_view name, size_t offset, std::string_view value, int id, bool with_text)
+    {
+        // worst case, every byte of name and value escaped as \u00XX
+        const size_t size = 96 + (name.size() + (with_text ? value.size() : 0)) * 6;
+        vector<char> large;
+        char *begin;
+        if (size <= out.buffer.size() - out.used || (out.flush(), size <= out.buffer.size()))
+            begin = out.buffer.data() + out.used;
+        else
+        {
+            large.resize(size);
+            begin = large.data();
+        }
+
+        char *it = json_literal(begin, "{\"kind\":");
+        it = json_string(it, name);
+        it = json_literal(it, ",\"offset\":");
+        it = std::to_chars(it, it + 20, offset).ptr;
+        it = json_literal(it, ",\"length\":");
+        it = std::to_chars(it, it + 20, value.size()).ptr;
+        if (id >= 0)
+        {
+            it = json_literal(it, ",\"id\":");
+            it = std::to_chars(it, it + 20, id).ptr;
+        }
+        if (with_text)
+        {
+            it = json_literal(it, ",\"text\":");
+            it = json_string(it, value);
+        }
+        *it++ = '}';
+
+        if (large.empty())
+            out.used = it - out.buffer.data();
+        else
+            out.write_with(begin, it - begin);
+    }
+
+    static inline void write_json_token(writer_t &out, const vocabulary_t &vocab, const token_view_t &token, const char *base, bool with_text)
+    {
+        write_json_token(out, token.rule >= 0 ? std::string_view(vocab.rules[token.rule].name) : type_name(token.type),
+            token.value.data() - base, token.value, token.id, with_text);
+    }
+}
+
+#endif